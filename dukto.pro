@@ -6,7 +6,7 @@
 # Additional import path used to resolve QML modules in Creator's code model
 QML_IMPORT_PATH =
 
-QT += network qml widgets
+QT += network qml quick widgets concurrent
 
 VERSION = 6.1.0
 
@@ -38,32 +38,59 @@ symbian:TARGET.CAPABILITY += NetworkServices
 
 # The .cpp file which was generated for your project. Feel free to hack it.
 SOURCES += \
+    src/avatarcache.cpp \
+    src/bandwidthshaper.cpp \
     src/buddylistitemmodel.cpp \
     src/destinationbuddy.cpp \
+    src/discoverysimulator.cpp \
+    src/duktodaemon.cpp \
     src/duktoprotocol.cpp \
+    src/fanoutsender.cpp \
     src/guibehind.cpp \
     src/ipaddressitemmodel.cpp \
     src/main.cpp \
     src/miniwebserver.cpp \
+    src/networkinterfacemonitor.cpp \
     src/platform.cpp \
     src/recentlistitemmodel.cpp \
+    src/screenshare.cpp \
     src/settings.cpp \
+    src/startupprofiler.cpp \
     src/theme.cpp \
-    src/updateschecker.cpp
+    src/tracer.cpp \
+    src/transferbenchmark.cpp \
+    src/transferprogress.cpp \
+    src/transfertelemetry.cpp \
+    src/updateschecker.cpp \
+    src/webserverbenchmark.cpp
 
 HEADERS += \
+    src/avatarcache.h \
+    src/bandwidthshaper.h \
     src/buddylistitemmodel.h \
     src/destinationbuddy.h \
+    src/discoverysimulator.h \
+    src/duktodaemon.h \
     src/duktoprotocol.h \
+    src/fanoutsender.h \
+    src/framing.h \
     src/guibehind.h \
     src/ipaddressitemmodel.h \
     src/miniwebserver.h \
+    src/networkinterfacemonitor.h \
     src/peer.h \
     src/platform.h \
     src/recentlistitemmodel.h \
+    src/screenshare.h \
     src/settings.h \
+    src/startupprofiler.h \
     src/theme.h \
-    src/updateschecker.h
+    src/tracer.h \
+    src/transferbenchmark.h \
+    src/transferprogress.h \
+    src/transfertelemetry.h \
+    src/updateschecker.h \
+    src/webserverbenchmark.h
 
 RESOURCES += \
     qml.qrc
@@ -39,6 +39,8 @@ Item {
                  buddySystem: system
                  buddyOsLogo: oslogo
                  buddyShowBack: showback
+                 buddyVerified: verified
+                 buddySelected: selected
              }
          }
 
@@ -31,11 +31,14 @@ Flipable {
 	property alias buddyUsername: buddyUsernameText.text
 	property alias buddySystem: buddySystemText.text
 	property bool buddyShowBack: false
+	property bool buddyVerified: true
+	property bool buddySelected: false
+	opacity: buddyVerified ? 1 : 0.5
 	Rectangle {
 		anchors.fill: parent
 		color: "#44DDDDDD"
 		z: 1
-		visible: buddyMouseArea.containsMouse
+		visible: buddyMouseArea.containsMouse || buddySelected
 		Rectangle {
 			anchors.right: parent.right
 			anchors.top: parent.top
@@ -206,7 +209,13 @@ Flipable {
 		anchors.left: parent.left
 		anchors.top: parent.top
 		hoverEnabled: true
-		onClicked: guiBehind.showSendPage(buddyIp)
+		onClicked: {
+			// Ctrl+click picks several buddies, to send them the same files
+			if ((mouse.modifiers & Qt.ControlModifier) && (buddyIp != "") && (buddyIp != "IP") && (buddyIp != "-"))
+				guiBehind.toggleBuddySelection(buddyIp)
+			else
+				guiBehind.showSendPage(buddyIp)
+		}
 
 		propagateComposedEvents: false
 		z: 100
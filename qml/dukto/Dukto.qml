@@ -68,6 +68,7 @@ Window {
 			onGotoTextSnippet: duktoOverlay.state = "showtext"
 			onGotoSendPage: duktoOverlay.state = "send";
 			onGotoMessagePage: duktoOverlay.state = "message";
+			onGotoScreenSharePage: duktoOverlay.state = "screenshare";
 			onHideAllOverlays: duktoOverlay.state = "";
 		}
 
@@ -74,6 +74,16 @@ Rectangle {
         }
     }
 
+    ScreenSharePage {
+        id: screenSharePage
+        anchors.top: parent.top
+        anchors.bottom: parent.bottom
+        width: parent.width
+        x: -50
+        opacity: 0
+        onBack: parent.state = ""
+    }
+
     SettingsPage {
         id: settingsPage
         width: parent.width
@@ -157,6 +167,14 @@ Rectangle {
                 x: 0
             }
         },
+        State {
+            name: "screenshare"
+            PropertyChanges {
+                target: screenSharePage
+                opacity: 1
+                x: 0
+            }
+        },
         State {
             name: "settings"
             PropertyChanges {
@@ -67,7 +67,7 @@ Item {
                      hoverEnabled: true
                      onClicked: {
                          if (type == "text")
-                            guiBehind.showTextSnippet(value, sender);
+                            guiBehind.showTextSnippet(textFile != "" ? recentListData.loadText(textFile) : value, sender);
                          else if (type == "file")
                             guiBehind.openFile(value);
                      }
@@ -0,0 +1,96 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2011 Emanuele Colombo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+
+import QtQuick 2.0
+
+Rectangle {
+    id: screenSharePage
+    color: theme.color6
+
+    signal back()
+
+    Image {
+        id: backIcon
+        source: "res/BackIconDark.png"
+        anchors.top: parent.top
+        anchors.left: parent.left
+        anchors.topMargin: 5
+        anchors.leftMargin: 5
+
+        MousePointerArea {
+            anchors.fill: parent
+            onClicked: {
+                guiBehind.closeScreenShare();
+                screenSharePage.back();
+            }
+        }
+    }
+
+    SmoothText {
+        id: boxTitle
+        anchors.left: backIcon.right
+        anchors.top: parent.top
+        anchors.leftMargin: 15
+        anchors.topMargin: 5
+        font.pixelSize: 64
+        text: "Screen"
+        color: theme.color3
+    }
+
+    SText {
+        id: boxSender
+        anchors.left: backIcon.right
+        anchors.top: parent.top
+        anchors.leftMargin: 17
+        anchors.right: parent.right
+        anchors.rightMargin: 20
+        anchors.topMargin: 45
+        elide: "ElideRight"
+        font.pixelSize: 16
+        text: "from " + guiBehind.screenShareBuddy
+        color: theme.color5
+    }
+
+    Rectangle {
+        id: rectangleScreen
+        border.color: theme.color3
+        border.width: 1
+        color: "#000000"
+        anchors.top: boxSender.bottom
+        anchors.topMargin: 10
+        anchors.left: parent.left
+        anchors.leftMargin: 15
+        anchors.bottom: parent.bottom
+        anchors.bottomMargin: 15
+        anchors.right: parent.right
+        anchors.rightMargin: 10
+
+        // Only the changed tiles are received, the image provider
+        // keeps the whole frame; the frame counter just reloads it
+        Image {
+            id: screenImage
+            anchors.fill: parent
+            anchors.margins: 1
+            fillMode: Image.PreserveAspectFit
+            smooth: true
+            cache: false
+            source: guiBehind.screenShareFrame > 0 ? "image://screenshare/" + guiBehind.screenShareFrame : ""
+        }
+    }
+}
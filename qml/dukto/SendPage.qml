@@ -66,7 +66,7 @@ Rectangle {
 		buddyGeneric: destinationBuddy.genericAvatar
 		buddyAvatar: destinationBuddy.avatar
 		buddyOsLogo:destinationBuddy.osLogo
-		buddyUsername: destinationBuddy.username
+		buddyUsername: (guiBehind.selectedBuddies > 1) ? destinationBuddy.username + " and " + (guiBehind.selectedBuddies - 1) + " more" : destinationBuddy.username
 		buddySystem: destinationBuddy.system
 		buddyIp: "-"
 	}
@@ -134,7 +134,7 @@ Rectangle {
 		anchors.topMargin: 15
 		anchors.left: localBuddy.left
 		width: 300
-		buttonEnabled: guiBehind.currentTransferBuddy !== ""
+		buttonEnabled: (guiBehind.currentTransferBuddy !== "") && (guiBehind.selectedBuddies < 2)
 		label: "Send some text"
 		onClicked: sendPage.showTextPage();
 	}
@@ -146,7 +146,7 @@ Rectangle {
 		anchors.left: localBuddy.left
 		width: 300
 		label: "Send text from clipboard"
-		buttonEnabled: guiBehind.clipboardTextAvailable && (guiBehind.currentTransferBuddy !== "")
+		buttonEnabled: guiBehind.clipboardTextAvailable && (guiBehind.currentTransferBuddy !== "") && (guiBehind.selectedBuddies < 2)
 		onClicked: guiBehind.sendClipboardText()
 	}
 
@@ -171,6 +171,51 @@ Rectangle {
 		label: "Send a folder"
 		onClicked: guiBehind.sendFolder()
 	}
+
+	ButtonDark {
+		id: buttonShareScreen
+		anchors.top: buttonSendFolder.bottom
+		anchors.topMargin: 15
+		anchors.left: localBuddy.left
+		width: 300
+		buttonEnabled: guiBehind.screenSharing || ((guiBehind.currentTransferBuddy !== "") && (guiBehind.selectedBuddies < 2))
+		label: guiBehind.screenSharing ? "Stop sharing your screen" : "Share your screen"
+		onClicked: guiBehind.toggleScreenShare()
+	}
+
+	SText {
+		id: labelBuddyBandwidth
+		visible: (destinationBuddy.ip != "IP") && (guiBehind.selectedBuddies < 2)
+		anchors.left: buttonSendText.right
+		anchors.leftMargin: 30
+		anchors.top: buttonSendText.top
+		font.pixelSize: 14
+		color: theme.color5
+		text: "Limit for this buddy\n(KB/s, 0 = none):"
+	}
+
+	Rectangle {
+		id: textBuddyBandwidth
+		visible: labelBuddyBandwidth.visible
+		anchors.left: labelBuddyBandwidth.left
+		anchors.top: labelBuddyBandwidth.bottom
+		anchors.topMargin: 8
+		border.color: theme.color5
+		border.width: 2
+		width: 100
+		height: 25
+
+		TextInput {
+			anchors.fill: parent
+			anchors.margins: 4
+			font.pixelSize: 14
+			color: theme.color5
+			selectByMouse: true
+			validator: IntValidator { bottom: 0 }
+			text: guiBehind.buddyBandwidthLimit(destinationBuddy.ip)
+			onEditingFinished: guiBehind.setBuddyBandwidthLimit(destinationBuddy.ip, parseInt(text))
+		}
+	}
 /*
 	ButtonDark {
 		id: buttonSendScreen
@@ -206,4 +206,69 @@ Rectangle {
         color: "#6D0D71"
         onClicked: picker.setColor(color)
     }
+
+    SText {
+        id: labelBandwidth
+        anchors.left: labelPath.left
+        anchors.top: picker.bottom
+        anchors.topMargin: 40
+        font.pixelSize: 16
+        text: "Bandwidth limit (KB/s, 0 = unlimited):"
+        color: theme.color5
+    }
+
+    Rectangle {
+        id: textBandwidth
+        anchors.left: labelBandwidth.left
+        anchors.top: labelBandwidth.bottom
+        anchors.topMargin: 8
+        border.color: theme.color5
+        border.width: 2
+        width: 100
+        height: 25
+
+        TextInput {
+            anchors.fill: parent
+            anchors.margins: 4
+            font.pixelSize: 14
+            color: theme.color5
+            selectByMouse: true
+            validator: IntValidator { bottom: 0 }
+            text: guiBehind.bandwidthLimit
+            onEditingFinished: guiBehind.bandwidthLimit = parseInt(text)
+        }
+    }
+
+    SText {
+        id: labelSchedule
+        anchors.left: labelBandwidth.left
+        anchors.top: textBandwidth.bottom
+        anchors.topMargin: 15
+        font.pixelSize: 16
+        text: "Limit schedule (e.g. 09:00-18:00=512, 22:00-06:00=0):"
+        color: theme.color5
+    }
+
+    Rectangle {
+        id: textSchedule
+        anchors.left: labelSchedule.left
+        anchors.top: labelSchedule.bottom
+        anchors.topMargin: 8
+        anchors.right: parent.right
+        anchors.rightMargin: 20
+        border.color: theme.color5
+        border.width: 2
+        height: 25
+
+        TextInput {
+            anchors.fill: parent
+            anchors.margins: 4
+            font.pixelSize: 14
+            color: theme.color5
+            selectByMouse: true
+            clip: true
+            text: guiBehind.bandwidthSchedule
+            onEditingFinished: guiBehind.bandwidthSchedule = text
+        }
+    }
 }
@@ -0,0 +1,182 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2011 Emanuele Colombo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "avatarcache.h"
+
+#include <QNetworkReply>
+#include <QStandardPaths>
+#include <QDir>
+#include <QFile>
+#include <QThread>
+#include <QCryptographicHash>
+
+#define AVATAR_MAX_FETCHES 4
+#define AVATAR_MEMORY_CACHE 8192            // KB
+#define AVATAR_MAX_SIZE 262144              // Larger downloads are discarded
+
+// ------------------------------------------------------------
+// AvatarResponse
+
+AvatarResponse::AvatarResponse(AvatarCache *cache, const QByteArray &hash, const QUrl &source) :
+    mCache(cache), mHash(hash), mSource(source)
+{
+}
+
+QQuickTextureFactory *AvatarResponse::textureFactory() const
+{
+    return QQuickTextureFactory::textureFactoryForImage(mImage);
+}
+
+void AvatarResponse::finish(const QImage &image)
+{
+    mImage = image;
+    emit finished();
+}
+
+void AvatarResponse::cancel()
+{
+    QMetaObject::invokeMethod(mCache, "dequeue", Qt::QueuedConnection, Q_ARG(AvatarResponse*, this));
+}
+
+// ------------------------------------------------------------
+// AvatarCache
+
+AvatarCache::AvatarCache() :
+    QObject(nullptr), mMemory(AVATAR_MEMORY_CACHE)
+{
+    qRegisterMetaType<AvatarResponse*>("AvatarResponse*");
+    mNetwork = new QNetworkAccessManager(this);
+    mDir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/avatars";
+    QDir().mkpath(mDir);
+}
+
+QUrl AvatarCache::avatarUrl(const QByteArray &hash, const QUrl &source)
+{
+    QByteArray encoded = source.toEncoded().toBase64(QByteArray::Base64UrlEncoding | QByteArray::OmitTrailingEquals);
+    return QUrl("image://avatar/" + hash.toHex() + "/" + encoded);
+}
+
+// Called by the QML image loader thread; the lookups and downloads are
+// queued to the thread of the cache, the GUI thread it was created in
+QQuickImageResponse *AvatarCache::requestImageResponse(const QString &id, const QSize &requestedSize)
+{
+    Q_UNUSED(requestedSize);
+    QByteArray hash = QByteArray::fromHex(id.section('/', 0, 0).toLatin1());
+    QUrl source = QUrl::fromEncoded(QByteArray::fromBase64(id.section('/', 1).toLatin1(), QByteArray::Base64UrlEncoding));
+
+    AvatarResponse *r = new AvatarResponse(this, hash, source);
+    r->moveToThread(thread());
+    QMetaObject::invokeMethod(this, "enqueue", Qt::QueuedConnection, Q_ARG(AvatarResponse*, r));
+    return r;
+}
+
+void AvatarCache::enqueue(AvatarResponse *r)
+{
+    // Memory
+    QImage *cached = mMemory.object(r->hash());
+    if (cached) {
+        r->finish(*cached);
+        return;
+    }
+
+    // Disk
+    QImage image(diskPath(r->hash()));
+    if (!image.isNull()) {
+        mMemory.insert(r->hash(), new QImage(image), qMax(image.sizeInBytes() / 1024, (qsizetype) 1));
+        r->finish(image);
+        return;
+    }
+
+    // Network, the latest request belongs to a delegate on screen
+    mQueue.prepend(r);
+    startFetches();
+}
+
+// The delegate is gone before the avatar arrived. The engine deletes
+// a cancelled response only after its finished(), so it's still emitted.
+// Responses already downloading are finished by fetchFinished().
+void AvatarCache::dequeue(AvatarResponse *r)
+{
+    // Compared by address: r may already be deleted if it was finished
+    bool queued = false;
+    for (int i = mQueue.size() - 1; i >= 0; i--)
+        if (mQueue.at(i).data() == r) {
+            mQueue.removeAt(i);
+            queued = true;
+        }
+    if (queued) r->finish(QImage());
+}
+
+void AvatarCache::startFetches()
+{
+    while ((mRunning.size() < AVATAR_MAX_FETCHES) && !mQueue.isEmpty())
+    {
+        QPointer<AvatarResponse> r = mQueue.takeFirst();
+        if (!r) continue;
+
+        // Already downloading the same avatar for another delegate
+        mWaiting[r->hash()].append(r);
+        if (mRunning.contains(r->hash())) continue;
+
+        QNetworkReply *reply = mNetwork->get(QNetworkRequest(r->source()));
+        reply->setProperty("avatarHash", r->hash());
+        mRunning.insert(r->hash(), reply);
+        connect(reply, SIGNAL(downloadProgress(qint64,qint64)), this, SLOT(fetchProgress(qint64,qint64)));
+        connect(reply, SIGNAL(finished()), this, SLOT(fetchFinished()));
+    }
+}
+
+// Oversized avatars are dropped as soon as they're known to be
+void AvatarCache::fetchProgress(qint64 received, qint64 total)
+{
+    if ((received > AVATAR_MAX_SIZE) || (total > AVATAR_MAX_SIZE)) {
+        QNetworkReply *reply = qobject_cast<QNetworkReply*>(sender());
+        if (reply) reply->abort();
+    }
+}
+
+void AvatarCache::fetchFinished()
+{
+    QNetworkReply *reply = qobject_cast<QNetworkReply*>(sender());
+    if (!reply) return;
+    QByteArray hash = reply->property("avatarHash").toByteArray();
+    mRunning.remove(hash);
+
+    QImage image;
+    QByteArray data;
+    if (reply->bytesAvailable() <= AVATAR_MAX_SIZE) data = reply->readAll();
+    // Only an avatar matching the announced hash is kept: any buddy can
+    // announce any hash, the cache would show its image for someone else
+    if ((reply->error() == QNetworkReply::NoError) && !data.isEmpty()
+        && (QCryptographicHash::hash(data, QCryptographicHash::Md5) == hash) && image.loadFromData(data))
+    {
+        QFile f(diskPath(hash));
+        if (f.open(QIODevice::WriteOnly | QIODevice::Truncate)) f.write(data);
+        mMemory.insert(hash, new QImage(image), qMax(image.sizeInBytes() / 1024, (qsizetype) 1));
+    }
+    reply->deleteLater();
+
+    foreach (const QPointer<AvatarResponse> &r, mWaiting.take(hash))
+        if (r) r->finish(image);
+    startFetches();
+}
+
+QString AvatarCache::diskPath(const QByteArray &hash)
+{
+    return mDir + "/" + hash.toHex();
+}
@@ -0,0 +1,92 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2011 Emanuele Colombo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef AVATARCACHE_H
+#define AVATARCACHE_H
+
+#include <QObject>
+#include <QQuickAsyncImageProvider>
+#include <QNetworkAccessManager>
+#include <QPointer>
+#include <QCache>
+#include <QHash>
+#include <QList>
+#include <QImage>
+#include <QUrl>
+
+class QNetworkReply;
+class AvatarCache;
+
+class AvatarResponse : public QQuickImageResponse
+{
+    Q_OBJECT
+
+public:
+    AvatarResponse(AvatarCache *cache, const QByteArray &hash, const QUrl &source);
+    QQuickTextureFactory *textureFactory() const;
+    void finish(const QImage &image);
+    inline QByteArray hash() const { return mHash; }
+    inline QUrl source() const { return mSource; }
+
+public slots:
+    void cancel();
+
+private:
+    AvatarCache *mCache;
+    QByteArray mHash;
+    QUrl mSource;
+    QImage mImage;
+};
+
+// Avatars of the buddies, keyed by the hash announced in their hello
+// (MD5 of the image file, checked on download).
+// Served to QML as "image://avatar/<hash>/<source>": they're looked up
+// in memory, then on disk, and only then downloaded from the buddy.
+// Downloads run a few at a time, the most recently requested first;
+// the images asked by delegates that scrolled away are dropped from the
+// queue, so the visible buddies come first.
+class AvatarCache : public QObject, public QQuickAsyncImageProvider
+{
+    Q_OBJECT
+
+public:
+    AvatarCache();
+    QQuickImageResponse *requestImageResponse(const QString &id, const QSize &requestedSize);
+    static QUrl avatarUrl(const QByteArray &hash, const QUrl &source);
+
+public slots:
+    void enqueue(AvatarResponse *r);
+    void dequeue(AvatarResponse *r);
+
+private slots:
+    void fetchProgress(qint64 received, qint64 total);
+    void fetchFinished();
+
+private:
+    void startFetches();
+    QString diskPath(const QByteArray &hash);
+
+    QString mDir;
+    QCache<QByteArray, QImage> mMemory;             // Cost in KB
+    QNetworkAccessManager *mNetwork;
+    QList<QPointer<AvatarResponse> > mQueue;        // Newest first
+    QHash<QByteArray, QNetworkReply*> mRunning;
+    QHash<QByteArray, QList<QPointer<AvatarResponse> > > mWaiting;
+};
+
+#endif // AVATARCACHE_H
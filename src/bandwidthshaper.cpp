@@ -0,0 +1,180 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2011 Emanuele Colombo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "bandwidthshaper.h"
+
+#include <QTime>
+#include <QRegExp>
+
+#include <limits>
+
+#define MIN_BUCKET_CAPACITY 4096
+
+// ------------------------------------------------------------
+// TokenBucket
+
+TokenBucket::TokenBucket()
+    : mRate(0), mCapacity(0), mTokens(0), mLastRefill(0)
+{
+    mClock.start();
+}
+
+void TokenBucket::setRate(qint64 bytesPerSecond)
+{
+    refill();
+    bool wasUnlimited = (mRate <= 0);
+    mRate = bytesPerSecond;
+    mCapacity = qMax(mRate / 20, (qint64) MIN_BUCKET_CAPACITY);
+    if (wasUnlimited || (mTokens > mCapacity)) mTokens = mCapacity;
+}
+
+void TokenBucket::refill()
+{
+    qint64 now = mClock.nsecsElapsed();
+    if (mRate > 0) {
+        mTokens += (now - mLastRefill) * (double) mRate / 1000000000.0;
+        if (mTokens > mCapacity) mTokens = mCapacity;
+    }
+    mLastRefill = now;
+}
+
+qint64 TokenBucket::available()
+{
+    if (mRate <= 0) return std::numeric_limits<qint64>::max();
+    refill();
+    return (mTokens > 0) ? (qint64) mTokens : 0;
+}
+
+void TokenBucket::consume(qint64 bytes)
+{
+    if (mRate <= 0) return;
+    refill();
+    mTokens -= bytes;
+}
+
+// Time to wait before a quarter of the bucket is available again,
+// short enough to keep the flow smooth but not a busy loop
+int TokenBucket::msUntilAvailable()
+{
+    if (mRate <= 0) return 0;
+    refill();
+    double target = mCapacity / 4.0;
+    if (mTokens >= target) return 0;
+    qint64 ms = (qint64) ((target - mTokens) * 1000.0 / mRate) + 1;
+    return (int) qBound((qint64) 1, ms, (qint64) 1000);
+}
+
+// ------------------------------------------------------------
+// BandwidthShaper
+
+BandwidthShaper::BandwidthShaper(QObject *parent) :
+    QObject(parent), mGlobalLimit(0)
+{
+}
+
+void BandwidthShaper::setGlobalLimit(qint64 bytesPerSecond)
+{
+    mGlobalLimit = bytesPerSecond;
+    mScheduleCheck.invalidate();
+    updateScheduledRate();
+    emit limitsChanged();
+}
+
+void BandwidthShaper::setPeerLimit(const QString &peer, qint64 bytesPerSecond)
+{
+    if (bytesPerSecond <= 0)
+        mPeerBuckets.remove(peer);
+    else
+        mPeerBuckets[peer].setRate(bytesPerSecond);
+    emit limitsChanged();
+}
+
+// Entries are in the form "HH:MM-HH:MM=KBps", e.g. "09:00-18:00=512".
+// A window can wrap around midnight ("22:00-06:00=0" lifts the limit
+// during the night). Outside every window the global limit applies.
+void BandwidthShaper::setSchedule(const QStringList &entries)
+{
+    QRegExp rx("^(\\d{1,2}):(\\d{2})-(\\d{1,2}):(\\d{2})=(\\d+)$");
+    mSchedule.clear();
+    foreach (const QString &entry, entries) {
+        if (rx.indexIn(entry.trimmed()) == -1) continue;
+        ScheduleEntry e;
+        e.from = rx.cap(1).toInt() * 60 + rx.cap(2).toInt();
+        e.to = rx.cap(3).toInt() * 60 + rx.cap(4).toInt();
+        e.rate = rx.cap(5).toLongLong() * 1024;
+        mSchedule.append(e);
+    }
+    mScheduleCheck.invalidate();
+    updateScheduledRate();
+    emit limitsChanged();
+}
+
+// Picks the global rate for the current time of day. It's checked at
+// most once per second, it's called for every chunk.
+void BandwidthShaper::updateScheduledRate()
+{
+    if (mScheduleCheck.isValid() && (mScheduleCheck.elapsed() < 1000)) return;
+    mScheduleCheck.start();
+
+    qint64 rate = mGlobalLimit;
+    if (!mSchedule.isEmpty()) {
+        QTime now = QTime::currentTime();
+        int minutes = now.hour() * 60 + now.minute();
+        foreach (const ScheduleEntry &e, mSchedule) {
+            bool inside = (e.from <= e.to) ? ((minutes >= e.from) && (minutes < e.to))
+                                           : ((minutes >= e.from) || (minutes < e.to));
+            if (inside) {
+                rate = e.rate;
+                break;
+            }
+        }
+    }
+
+    if (rate != mGlobalBucket.rate()) mGlobalBucket.setRate(rate);
+}
+
+bool BandwidthShaper::isLimited(const QString &peer)
+{
+    updateScheduledRate();
+    return (mGlobalBucket.rate() > 0) || mPeerBuckets.contains(peer);
+}
+
+// Returns how many of the wanted bytes can be moved right now
+qint64 BandwidthShaper::allowance(const QString &peer, qint64 wanted)
+{
+    updateScheduledRate();
+    qint64 a = qMin(wanted, mGlobalBucket.available());
+    if (mPeerBuckets.contains(peer))
+        a = qMin(a, mPeerBuckets[peer].available());
+    return a;
+}
+
+void BandwidthShaper::consume(const QString &peer, qint64 bytes)
+{
+    mGlobalBucket.consume(bytes);
+    if (mPeerBuckets.contains(peer))
+        mPeerBuckets[peer].consume(bytes);
+}
+
+int BandwidthShaper::msUntilAvailable(const QString &peer)
+{
+    int ms = mGlobalBucket.msUntilAvailable();
+    if (mPeerBuckets.contains(peer))
+        ms = qMax(ms, mPeerBuckets[peer].msUntilAvailable());
+    return qMax(ms, 1);
+}
@@ -0,0 +1,88 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2011 Emanuele Colombo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef BANDWIDTHSHAPER_H
+#define BANDWIDTHSHAPER_H
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QStringList>
+#include <QElapsedTimer>
+
+// Classic token bucket. The bucket holds at most 50 ms worth of
+// tokens, so data leaves in small, evenly spaced bursts instead of
+// long sleeps followed by line-rate spikes.
+class TokenBucket
+{
+public:
+    TokenBucket();
+    void setRate(qint64 bytesPerSecond);
+    inline qint64 rate() const { return mRate; }
+    qint64 available();
+    void consume(qint64 bytes);
+    int msUntilAvailable();
+
+private:
+    void refill();
+
+    qint64 mRate;               // Bytes per second, 0 means unlimited
+    qint64 mCapacity;           // Max tokens stored
+    double mTokens;             // Can go negative when a chunk is larger than the bucket
+    QElapsedTimer mClock;
+    qint64 mLastRefill;         // Nanoseconds, from mClock
+};
+
+// Global and per-peer bandwidth limits, with an optional time-of-day
+// schedule overriding the global limit. Every setter is applied
+// immediately, including to the transfers already running. Buddies are
+// identified by DuktoProtocol::peerKey().
+class BandwidthShaper : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit BandwidthShaper(QObject *parent = nullptr);
+    void setGlobalLimit(qint64 bytesPerSecond);
+    void setPeerLimit(const QString &peer, qint64 bytesPerSecond);
+    void setSchedule(const QStringList &entries);
+    bool isLimited(const QString &peer);
+    qint64 allowance(const QString &peer, qint64 wanted);
+    void consume(const QString &peer, qint64 bytes);
+    int msUntilAvailable(const QString &peer);
+
+signals:
+    void limitsChanged();
+
+private:
+    struct ScheduleEntry {
+        int from;               // Minutes since midnight
+        int to;
+        qint64 rate;
+    };
+
+    void updateScheduledRate();
+
+    TokenBucket mGlobalBucket;
+    qint64 mGlobalLimit;
+    QHash<QString, TokenBucket> mPeerBuckets;     // By peer key
+    QList<ScheduleEntry> mSchedule;
+    QElapsedTimer mScheduleCheck;
+};
+
+#endif // BANDWIDTHSHAPER_H
@@ -19,10 +19,46 @@
 #include "buddylistitemmodel.h"
 
 #include <QUrl>
-#include <QRegExp>
 
 #include "platform.h"
 #include "peer.h"
+#include "avatarcache.h"
+
+// Generic avatar and OS logo for each platform name
+struct PlatformInfo {
+    const char *name;
+    const char *genericAvatar;
+    const char *osLogo;
+};
+
+static const PlatformInfo platformTable[] = {
+    { "windows",      "res/PcLogo.png",         "res/WindowsLogo.png" },
+    { "macintosh",    "res/PcLogo.png",         "res/AppleLogo.png" },
+    { "linux",        "res/PcLogo.png",         "res/LinuxLogo.png" },
+    { "symbian",      "res/SmartphoneLogo.png", "res/SymbianLogo.png" },
+    { "ios",          "res/SmartphoneLogo.png", "res/IosLogo.png" },
+    { "windowsphone", "res/SmartphoneLogo.png", "res/WindowsPhoneLogo.png" },
+    { "blackberry",   "res/SmartphoneLogo.png", "res/BlackberryLogo.png" },
+    { "android",      "res/SmartphoneLogo.png", "res/AndroidLogo.png" },
+    { "ip",           "res/IpLogo.png",         "res/UnknownLogo.png" }
+};
+
+static const PlatformInfo unknownPlatform = { "", "res/PcLogo.png", "res/UnknownLogo.png" };
+
+static const PlatformInfo& platformInfo(const QString &platform)
+{
+    for (unsigned int i = 0; i < sizeof(platformTable) / sizeof(platformTable[0]); i++)
+        if (platform.compare(QLatin1String(platformTable[i].name), Qt::CaseInsensitive) == 0)
+            return platformTable[i];
+    return unknownPlatform;
+}
+
+// Roles are only written when they change, so that a hello repeating
+// the same data doesn't make QML update the bindings
+static void setIfChanged(QStandardItem *it, const QVariant &value, int role)
+{
+    if (it->data(role) != value) it->setData(value, role);
+}
 
 BuddyListItemModel::BuddyListItemModel() :
     QStandardItemModel(nullptr)
@@ -37,6 +73,8 @@ BuddyListItemModel::BuddyListItemModel() :
     roleNames[Avatar] = "avatar";
     roleNames[OsLogo] = "oslogo";
     roleNames[ShowBack] = "showback";
+    roleNames[Verified] = "verified";
+    roleNames[Selected] = "selected";
     setItemRoleNames(roleNames);
 }
 
@@ -60,7 +98,7 @@ void BuddyListItemModel::addIpElement()
              QUrl(""));
 }
 
-void BuddyListItemModel::addBuddy(QString ip, qint16 port, QString username, QString system, QString platform, QUrl avatarPath)
+void BuddyListItemModel::addBuddy(QString ip, qint16 port, QString username, QString system, QString platform, QUrl avatarPath, bool verified)
 {
     QStandardItem* it = nullptr;
     bool add = true;
@@ -70,48 +108,28 @@ void BuddyListItemModel::addBuddy(QString ip, qint16 port, QString username, QSt
         it = mItemsMap[ip];
         add = false;
     }
-    else
+    else {
         it = new QStandardItem();
-    it->setData(ip, BuddyListItemModel::Ip);
-    it->setData(port, BuddyListItemModel::Port);
-    it->setData(false, BuddyListItemModel::ShowBack);
+        it->setData(false, BuddyListItemModel::ShowBack);
+        it->setData(false, BuddyListItemModel::Selected);
+    }
+    setIfChanged(it, ip, BuddyListItemModel::Ip);
+    setIfChanged(it, port, BuddyListItemModel::Port);
+    setIfChanged(it, verified, BuddyListItemModel::Verified);
 
     // Set (or update) data
-    it->setData(username, BuddyListItemModel::Username);
+    setIfChanged(it, username, BuddyListItemModel::Username);
     if (ip != "IP")
-        it->setData("at " + system, BuddyListItemModel::System);
-    else
-        it->setData(system, BuddyListItemModel::System);
-    it->setData(platform, BuddyListItemModel::Platform);
-    it->setData(avatarPath, BuddyListItemModel::Avatar);
-
-    // Update generic avatar
-    if ((platform.toLower() == "symbian") || (platform.toLower() == "android") || (platform.toLower() == "ios") || (platform.toLower() == "blackberry") || (platform.toLower() == "windowsphone"))
-        it->setData("res/SmartphoneLogo.png", BuddyListItemModel::GenericAvatar);
-    else if (platform.toLower() == "ip")
-        it->setData("res/IpLogo.png", BuddyListItemModel::GenericAvatar);
+        setIfChanged(it, QString("at " + system), BuddyListItemModel::System);
     else
-        it->setData("res/PcLogo.png", BuddyListItemModel::GenericAvatar);
-
-    // Update logo
-    if (platform.toLower() == "windows")
-        it->setData("res/WindowsLogo.png", BuddyListItemModel::OsLogo);
-    else if (platform.toLower() == "macintosh")
-        it->setData("res/AppleLogo.png", BuddyListItemModel::OsLogo);
-    else if (platform.toLower() == "linux")
-        it->setData("res/LinuxLogo.png", BuddyListItemModel::OsLogo);
-    else if (platform.toLower() == "symbian")
-        it->setData("res/SymbianLogo.png", BuddyListItemModel::OsLogo);
-    else if (platform.toLower() == "ios")
-        it->setData("res/IosLogo.png", BuddyListItemModel::OsLogo);
-    else if (platform.toLower() == "windowsphone")
-        it->setData("res/WindowsPhoneLogo.png", BuddyListItemModel::OsLogo);
-    else if (platform.toLower() == "blackberry")
-        it->setData("res/BlackberryLogo.png", BuddyListItemModel::OsLogo);
-    else if (platform.toLower() == "android")
-        it->setData("res/AndroidLogo.png", BuddyListItemModel::OsLogo);
-    else
-        it->setData("res/UnknownLogo.png", BuddyListItemModel::OsLogo);
+        setIfChanged(it, system, BuddyListItemModel::System);
+    setIfChanged(it, platform, BuddyListItemModel::Platform);
+    setIfChanged(it, avatarPath, BuddyListItemModel::Avatar);
+
+    // Generic avatar and logo
+    const PlatformInfo &info = platformInfo(platform);
+    setIfChanged(it, QString(info.genericAvatar), BuddyListItemModel::GenericAvatar);
+    setIfChanged(it, QString(info.osLogo), BuddyListItemModel::OsLogo);
 
     // Add elemento to the list
     if (add) {
@@ -125,21 +143,22 @@ void BuddyListItemModel::addBuddy(QString ip, qint16 port, QString username, QSt
 
 void BuddyListItemModel::addBuddy(Peer &peer)
 {
-    QRegExp rx("^(.*)\\sat\\s(.*)\\s\\((.*)\\)$");
-    rx.indexIn(peer.name);
-    QStringList data = rx.capturedTexts();
+    QString host = peer.address.toString();
+    if (peer.address.protocol() == QAbstractSocket::IPv6Protocol)
+        host = "[" + host.replace("%", "%25") + "]";
+    QUrl avatarPath = QUrl("http://" + host + ":" + QString::number(peer.port + 1) + "/dukto/avatar");
 
-    QString username = data[1];
-    QString system = data[2];
-    QString platform = data[3];
-    QUrl avatarPath = QUrl("http://" + peer.address.toString() + ":" + QString::number(peer.port + 1) + "/dukto/avatar");
+    // Buddies announcing the hash of their avatar go through the cache
+    if (!peer.avatarHash.isEmpty())
+        avatarPath = AvatarCache::avatarUrl(peer.avatarHash, avatarPath);
 
     addBuddy(peer.address.toString(),
              peer.port,
-             username,
-             system,
-             platform,
-             avatarPath);
+             peer.user,
+             peer.host,
+             peer.platform,
+             avatarPath,
+             peer.verified);
 }
 
 void BuddyListItemModel::removeBuddy(QString ip)
@@ -180,6 +199,33 @@ QString BuddyListItemModel::fistBuddyIp()
     return this->index(2, 0).data(BuddyListItemModel::Ip).toString();
 }
 
+// Selection of the buddies for a one-to-many send (Ctrl+click)
+bool BuddyListItemModel::toggleSelected(QString ip)
+{
+    if ((ip == "IP") || !mItemsMap.contains(ip)) return false;
+    QStandardItem *it = mItemsMap.value(ip);
+    bool selected = !it->data(BuddyListItemModel::Selected).toBool();
+    it->setData(selected, BuddyListItemModel::Selected);
+    return selected;
+}
+
+QStringList BuddyListItemModel::selectedIps()
+{
+    QStringList ips;
+    for (int i = 0; i < rowCount(); i++) {
+        QModelIndex idx = index(i, 0);
+        if (idx.data(BuddyListItemModel::Selected).toBool())
+            ips.append(idx.data(BuddyListItemModel::Ip).toString());
+    }
+    return ips;
+}
+
+void BuddyListItemModel::clearSelection()
+{
+    foreach (QStandardItem *it, mItemsMap)
+        setIfChanged(it, false, BuddyListItemModel::Selected);
+}
+
 void BuddyListItemModel::updateMeElement()
 {
     mMeItem->setData(Platform::getSystemUsername(), BuddyListItemModel::Username);
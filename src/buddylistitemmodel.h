@@ -20,6 +20,7 @@
 #define BUDDYLISTITEMMODEL_H
 
 #include <QStandardItemModel>
+#include <QStringList>
 
 class Peer;
 class QUrl;
@@ -30,7 +31,7 @@ public:
     BuddyListItemModel();
     void addMeElement();
     void addIpElement();
-    void addBuddy(QString ip, qint16 port, QString username, QString system, QString platform, QUrl avatarPath);
+    void addBuddy(QString ip, qint16 port, QString username, QString system, QString platform, QUrl avatarPath, bool verified = true);
     void addBuddy(Peer& peer);
     void removeBuddy(QString ip);
     void showSingleBack(int idx);
@@ -38,6 +39,9 @@ public:
     QString buddyNameByIp(QString ip);
     QStandardItem* buddyByIp(QString ip);
     QString fistBuddyIp();
+    bool toggleSelected(QString ip);
+    QStringList selectedIps();
+    void clearSelection();
 
     enum BuddyRoles {
         Ip = Qt::UserRole + 1,
@@ -48,7 +52,9 @@ public:
         GenericAvatar,
         Avatar,
         OsLogo,
-        ShowBack
+        ShowBack,
+        Verified,
+        Selected            // Picked for a one-to-many send
     };
 
 private:
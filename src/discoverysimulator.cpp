@@ -0,0 +1,280 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2011 Emanuele Colombo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "discoverysimulator.h"
+
+#include <QTextStream>
+#include <QFile>
+#include <QRandomGenerator>
+
+#include <algorithm>
+
+#if defined(Q_OS_LINUX)
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#define DEFAULT_PEERS 1000
+#define DEFAULT_HELLO_RATE 2000
+#define DEFAULT_GOODBYE_RATE 20
+#define DEFAULT_DURATION 20
+#define DEFAULT_PORT 14644
+#define TICK_INTERVAL 10
+
+DiscoverySimulator::DiscoverySimulator(QObject *parent) :
+    QObject(parent),
+    mPeerCount(DEFAULT_PEERS), mHelloRate(DEFAULT_HELLO_RATE), mGoodbyeRate(DEFAULT_GOODBYE_RATE),
+    mDuration(DEFAULT_DURATION), mPort(DEFAULT_PORT),
+    mHelloCredit(0), mGoodbyeCredit(0), mNextPeer(0), mAnnounced(0),
+    mHellosSent(0), mGoodbyesSent(0), mRepliesReceived(0), mAddedSignals(0), mRemovedSignals(0),
+    mModelTime(0), mModelUpdates(0), mCpuStart(0), mRssBefore(0), mRssAllKnown(0)
+{
+    connect(&mTickTimer, SIGNAL(timeout()), this, SLOT(tick()));
+    connect(&mProtocol, SIGNAL(peerListAdded(Peer)), this, SLOT(peerAdded(Peer)));
+    connect(&mProtocol, SIGNAL(peerListRemoved(Peer)), this, SLOT(peerRemoved(Peer)));
+}
+
+DiscoverySimulator::~DiscoverySimulator()
+{
+    for (int i = 0; i < mPeers.size(); i++)
+        delete mPeers[i].socket;
+}
+
+// Options: --peers=N --rate=HELLOS_PER_SEC --goodbye-rate=N --duration=SEC --port=P
+bool DiscoverySimulator::configure(const QStringList &args)
+{
+    QTextStream err(stderr);
+    foreach (const QString &arg, args.mid(1))
+    {
+        if (arg == "--simulate-discovery") continue;
+        QString name = arg.section('=', 0, 0);
+        bool ok = false;
+        int value = arg.section('=', 1).toInt(&ok);
+        if (!ok || (value < 0)) name.clear();
+
+        if (name == "--peers") mPeerCount = value;
+        else if (name == "--rate") mHelloRate = value;
+        else if (name == "--goodbye-rate") mGoodbyeRate = value;
+        else if (name == "--duration") mDuration = value;
+        else if ((name == "--port") && (value <= 32767)) mPort = value;
+        else
+        {
+            err << "Unknown or malformed option: " << arg << Qt::endl
+                << "Usage: dukto --simulate-discovery [--peers=N] [--rate=N] [--goodbye-rate=N] [--duration=SEC] [--port=P]" << Qt::endl;
+            return false;
+        }
+    }
+
+    // Each buddy takes one of the 127.1.x.y addresses and a port after mPort
+    if ((mPeerCount > 0xFFFF) || (mPort + mPeerCount > 32767))
+    {
+        err << "Too many buddies: --peers=" << mPeerCount << " with --port=" << mPort
+            << " allows at most " << qMin(0xFFFF, 32767 - mPort) << Qt::endl;
+        return false;
+    }
+    return (mPeerCount > 0) && (mDuration > 0);
+}
+
+void DiscoverySimulator::start()
+{
+#if defined(Q_OS_LINUX)
+    // A socket for each virtual buddy
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0)
+    {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+#endif
+
+    mProtocol.setPorts(mPort, mPort);
+    mProtocol.initialize();
+
+    // Buddies are told apart by address, each one gets its own
+    // loopback address (127.1.x.y) and its own port
+    for (int i = 0; i < mPeerCount; i++)
+    {
+        VirtualPeer p;
+        quint32 n = i + 1;
+        p.address = QHostAddress((127u << 24) | (1u << 16) | (n & 0xFFFF));
+        p.port = mPort + 1 + i;
+        p.announced = false;
+        p.socket = new QUdpSocket();
+        if (!p.socket->bind(p.address, p.port))
+        {
+            QTextStream(stderr) << "Cannot bind " << p.address.toString() << ":" << p.port
+                                << ", stopping at " << i << " buddies" << Qt::endl;
+            delete p.socket;
+            break;
+        }
+        connect(p.socket, SIGNAL(readyRead()), this, SLOT(readReplies()));
+        mPeers.append(p);
+    }
+    mPeerCount = mPeers.size();
+
+    mRssBefore = residentMemory();
+    mCpuStart = std::clock();
+    mClock.start();
+    mTickTimer.start(TICK_INTERVAL);
+    QTimer::singleShot(mDuration * 1000, this, SLOT(stop()));
+}
+
+// Hello of a virtual buddy, with the port (0x04/0x05)
+QByteArray DiscoverySimulator::helloPacket(int i, bool solicit)
+{
+    Peer identity;
+    identity.user = QString("sim%1").arg(i);
+    identity.host = QString("simhost-%1").arg(i);
+    identity.platform = "Linux";
+    identity.name = identity.user + " at " + identity.host + " (" + identity.platform + ")";
+    identity.caps = DuktoProtocol::localCapabilities();
+    identity.instanceId = QByteArray::number(i).rightJustified(16, '0');
+
+    QByteArray packet;
+    packet.append(solicit ? 0x04 : 0x05);
+    qint16 port = mPeers.at(i).port;
+    packet.append((char*) &port, sizeof(port));
+    packet.append(DuktoProtocol::helloPayload(identity));
+    return packet;
+}
+
+void DiscoverySimulator::sendTo(VirtualPeer &p, const QByteArray &packet)
+{
+    p.socket->writeDatagram(packet, QHostAddress::LocalHost, mPort);
+}
+
+void DiscoverySimulator::tick()
+{
+    if (mPeers.isEmpty()) return;
+    mHelloCredit += mHelloRate * TICK_INTERVAL / 1000.0;
+    mGoodbyeCredit += mGoodbyeRate * TICK_INTERVAL / 1000.0;
+
+    // Hellos, round robin: the first one of a buddy asks for a reply
+    while (mHelloCredit >= 1)
+    {
+        VirtualPeer &p = mPeers[mNextPeer];
+        mSentAt[p.address] = mClock.nsecsElapsed();
+        sendTo(p, helloPacket(mNextPeer, !p.announced));
+        if (!p.announced) mAnnounced++;
+        p.announced = true;
+        mHellosSent++;
+        mHelloCredit -= 1;
+        mNextPeer = (mNextPeer + 1) % mPeers.size();
+    }
+
+    // Goodbyes from random buddies, they come back on their next hello
+    while (mGoodbyeCredit >= 1)
+    {
+        mGoodbyeCredit -= 1;
+        VirtualPeer &p = mPeers[QRandomGenerator::global()->bounded(mPeers.size())];
+        if (!p.announced) continue;
+        mSentAt[p.address] = mClock.nsecsElapsed();
+        sendTo(p, QByteArray("\x03" "Bye Bye"));
+        p.announced = false;
+        mAnnounced--;
+        mGoodbyesSent++;
+    }
+}
+
+void DiscoverySimulator::peerAdded(Peer peer)
+{
+    mAddedSignals++;
+    if (mSentAt.contains(peer.address))
+        mLatencies.append(mClock.nsecsElapsed() - mSentAt.take(peer.address));
+
+    qint64 t = mClock.nsecsElapsed();
+    mModel.addBuddy(peer);
+    mModelTime += mClock.nsecsElapsed() - t;
+    mModelUpdates++;
+
+    if ((mRssAllKnown == 0) && (mModel.rowCount() >= mPeerCount))
+        mRssAllKnown = residentMemory();
+}
+
+void DiscoverySimulator::peerRemoved(Peer peer)
+{
+    mRemovedSignals++;
+    if (mSentAt.contains(peer.address))
+        mLatencies.append(mClock.nsecsElapsed() - mSentAt.take(peer.address));
+
+    qint64 t = mClock.nsecsElapsed();
+    mModel.removeBuddy(peer.address.toString());
+    mModelTime += mClock.nsecsElapsed() - t;
+    mModelUpdates++;
+}
+
+// Replies of the DuktoProtocol under test to the virtual buddies
+void DiscoverySimulator::readReplies()
+{
+    QUdpSocket *socket = qobject_cast<QUdpSocket*>(sender());
+    if (!socket) return;
+    char buffer[2048];
+    while (socket->hasPendingDatagrams())
+    {
+        socket->readDatagram(buffer, sizeof(buffer));
+        mRepliesReceived++;
+    }
+}
+
+void DiscoverySimulator::stop()
+{
+    mTickTimer.stop();
+    report();
+    emit finished();
+}
+
+void DiscoverySimulator::report()
+{
+    double seconds = mClock.elapsed() / 1000.0;
+    double cpu = (double) (std::clock() - mCpuStart) / CLOCKS_PER_SEC;
+    std::sort(mLatencies.begin(), mLatencies.end());
+    qint64 p50 = mLatencies.isEmpty() ? 0 : mLatencies.at(mLatencies.size() / 2);
+    qint64 p99 = mLatencies.isEmpty() ? 0 : mLatencies.at(qMin(mLatencies.size() - 1, mLatencies.size() * 99 / 100));
+    qint64 max = mLatencies.isEmpty() ? 0 : mLatencies.last();
+
+    QTextStream out(stdout);
+    out << "Virtual buddies:          " << mPeerCount << Qt::endl
+        << "Duration:                 " << seconds << " s" << Qt::endl
+        << "Hellos sent:              " << mHellosSent << " (" << (mHellosSent / seconds) << "/s)" << Qt::endl
+        << "Goodbyes sent:            " << mGoodbyesSent << Qt::endl
+        << "Replies received:         " << mRepliesReceived << Qt::endl
+        << "Buddy list added/removed: " << mAddedSignals << "/" << mRemovedSignals << Qt::endl
+        << "Buddies in the list:      " << (mModel.rowCount()) << Qt::endl
+        << "Process CPU time:         " << cpu << " s (" << (100.0 * cpu / seconds) << "%)" << Qt::endl
+        << "CPU per packet:           " << ((mHellosSent + mGoodbyesSent) ? (cpu * 1e6 / (mHellosSent + mGoodbyesSent)) : 0) << " us" << Qt::endl
+        << "Packet to model latency:  p50 " << (p50 / 1000) << " us, p99 " << (p99 / 1000) << " us, max " << (max / 1000) << " us" << Qt::endl
+        << "Model update cost:        " << (mModelUpdates ? (mModelTime / mModelUpdates / 1000.0) : 0) << " us avg over " << mModelUpdates << " updates" << Qt::endl;
+    if ((mRssBefore > 0) && (mRssAllKnown > 0))
+        out << "Memory per buddy:         " << ((mRssAllKnown - mRssBefore) / mPeerCount) << " bytes" << Qt::endl;
+    else
+        out << "Memory per buddy:         n/a" << Qt::endl;
+}
+
+// Resident set size in bytes (Linux only, 0 elsewhere)
+qint64 DiscoverySimulator::residentMemory()
+{
+#if defined(Q_OS_LINUX)
+    QFile f("/proc/self/statm");
+    if (!f.open(QIODevice::ReadOnly)) return 0;
+    QList<QByteArray> fields = f.readAll().split(' ');
+    if (fields.size() < 2) return 0;
+    return fields.at(1).toLongLong() * sysconf(_SC_PAGESIZE);
+#else
+    return 0;
+#endif
+}
@@ -0,0 +1,111 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2011 Emanuele Colombo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef DISCOVERYSIMULATOR_H
+#define DISCOVERYSIMULATOR_H
+
+#include <QObject>
+#include <QList>
+#include <QHash>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QtNetwork/QUdpSocket>
+
+#include <ctime>
+
+#include "duktoprotocol.h"
+#include "buddylistitemmodel.h"
+
+// Headless benchmark of the discovery path (dukto --simulate-discovery).
+// Many virtual buddies, each on its own loopback address and port,
+// flood a DuktoProtocol instance with hellos and goodbyes at the given
+// rates; the buddy list model is fed as GuiBehind does. At the end it
+// prints CPU time, hello-to-model latency, model update cost, memory
+// per buddy and the replies the virtual buddies received.
+// No QML engine is loaded: the cost of the BuddiesPage delegates
+// reacting to the model isn't part of the figures, which stop at
+// BuddyListItemModel.
+class DiscoverySimulator : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit DiscoverySimulator(QObject *parent = nullptr);
+    virtual ~DiscoverySimulator();
+    bool configure(const QStringList &args);
+    void start();
+
+signals:
+    void finished();
+
+private slots:
+    void tick();
+    void stop();
+    void peerAdded(Peer peer);
+    void peerRemoved(Peer peer);
+    void readReplies();
+
+private:
+    struct VirtualPeer {
+        QUdpSocket *socket;
+        QHostAddress address;
+        qint16 port;
+        bool announced;
+    };
+
+    QByteArray helloPacket(int i, bool solicit);
+    void sendTo(VirtualPeer &p, const QByteArray &packet);
+    void report();
+    static qint64 residentMemory();
+
+    DuktoProtocol mProtocol;
+    BuddyListItemModel mModel;
+    QList<VirtualPeer> mPeers;
+    QHash<QHostAddress, qint64> mSentAt;    // ns, mClock time of the last hello sent
+    QElapsedTimer mClock;
+    QTimer mTickTimer;
+
+    // Configuration
+    int mPeerCount;
+    int mHelloRate;                 // Hellos per second
+    int mGoodbyeRate;               // Goodbyes per second
+    int mDuration;                  // Seconds
+    qint16 mPort;                   // Port of the DuktoProtocol under test
+
+    // Flood state
+    double mHelloCredit;
+    double mGoodbyeCredit;
+    int mNextPeer;
+    int mAnnounced;
+
+    // Statistics
+    qint64 mHellosSent;
+    qint64 mGoodbyesSent;
+    qint64 mRepliesReceived;
+    qint64 mAddedSignals;
+    qint64 mRemovedSignals;
+    QList<qint64> mLatencies;       // ns
+    qint64 mModelTime;              // ns
+    qint64 mModelUpdates;
+    std::clock_t mCpuStart;
+    qint64 mRssBefore;
+    qint64 mRssAllKnown;            // RSS when every buddy was in the list
+};
+
+#endif // DISCOVERYSIMULATOR_H
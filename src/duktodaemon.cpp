@@ -0,0 +1,395 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2011 Emanuele Colombo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "duktodaemon.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QRegExp>
+#include <QTextStream>
+#include <QSocketNotifier>
+
+#if defined(Q_OS_UNIX)
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+#define NETWORK_PORT 4644
+// Periodic hellos of the buddies without heartbeats
+#define HELLO_INTERVAL 60000
+// Time given to discovery to find a buddy by name
+#define RESOLVE_TIMEOUT 5000
+
+#if defined(Q_OS_UNIX)
+static int quitPipe[2] = { -1, -1 };
+
+static void quitSignalHandler(int)
+{
+    char c = 1;
+    if (write(quitPipe[1], &c, sizeof(c)) < 0) return;
+}
+#endif
+
+DuktoDaemon::DuktoDaemon(QObject *parent) :
+    QObject(parent), mMode(Daemon), mSendStarted(false), mLimit(-1)
+{
+    mDir = QDir::currentPath();
+    mResolveTimer.setSingleShot(true);
+    connect(&mResolveTimer, SIGNAL(timeout()), this, SLOT(resolveTimeout()));
+
+    connect(&mProtocol, SIGNAL(peerListAdded(Peer)), this, SLOT(peerListAdded(Peer)));
+    connect(&mProtocol, SIGNAL(peerListRemoved(Peer)), this, SLOT(peerListRemoved(Peer)));
+    connect(&mProtocol, SIGNAL(receiveFileStart(QString)), this, SLOT(receiveFileStart(QString)));
+    connect(&mProtocol, SIGNAL(receiveFileComplete(QStringList*,qint64)), this, SLOT(receiveFileComplete(QStringList*,qint64)));
+    connect(&mProtocol, SIGNAL(receiveTextComplete(QString*,qint64)), this, SLOT(receiveTextComplete(QString*,qint64)));
+    connect(&mProtocol, SIGNAL(receiveFileCancelled()), this, SLOT(receiveFileCancelled()));
+    connect(&mProtocol, SIGNAL(sendFileComplete(QStringList*)), this, SLOT(sendFileComplete(QStringList*)));
+    connect(&mProtocol, SIGNAL(sendFileError(int)), this, SLOT(sendFileError(int)));
+    connect(&mProtocol, SIGNAL(sendFileAborted()), this, SLOT(sendFileAborted()));
+    connect(&mProtocol, SIGNAL(fanOutDestinationFailed(QString,int)), this, SLOT(fanOutDestinationFailed(QString,int)));
+}
+
+bool DuktoDaemon::isHeadlessCommand(int argc, char *argv[])
+{
+    if (argc < 2) return false;
+    return (qstrcmp(argv[1], "--daemon") == 0) || (qstrcmp(argv[1], "send") == 0) || (qstrcmp(argv[1], "receive") == 0);
+}
+
+bool DuktoDaemon::configure(const QStringList &args)
+{
+    QString command = args.value(1);
+    QStringList rest = args.mid(2);
+    if (!takeBandwidthOptions(rest)) {
+        usage();
+        return false;
+    }
+
+    if (command == "send")
+    {
+        mMode = Send;
+        if (rest.size() < 2) {
+            usage();
+            return false;
+        }
+        mDestinations = rest.takeFirst().split(',', Qt::SkipEmptyParts);
+        if (mDestinations.isEmpty()) {
+            usage();
+            return false;
+        }
+        foreach (const QString &path, rest)
+        {
+            QFileInfo fi(path);
+            if (!fi.exists()) {
+                QTextStream(stderr) << "No such file or directory: " << path << Qt::endl;
+                return false;
+            }
+            mPaths.append(fi.absoluteFilePath());
+        }
+        return true;
+    }
+
+    mMode = (command == "receive") ? Receive : Daemon;
+    while (!rest.isEmpty())
+    {
+        QString arg = rest.takeFirst();
+        if ((arg == "--dir") && !rest.isEmpty())
+            mDir = rest.takeFirst();
+        else if (arg.startsWith("--dir="))
+            mDir = arg.mid(6);
+        else {
+            usage();
+            return false;
+        }
+    }
+    if (!QDir(mDir).exists()) {
+        QTextStream(stderr) << "No such directory: " << mDir << Qt::endl;
+        return false;
+    }
+    return true;
+}
+
+// Rate limits for this run only, on top of the saved ones:
+//   --limit KBPS                   global limit
+//   --buddy-limit BUDDY=KBPS       limit of a buddy (name, address or instance ID)
+//   --schedule HH:MM-HH:MM=KBPS    time window of the global limit, repeatable
+bool DuktoDaemon::takeBandwidthOptions(QStringList &args)
+{
+    QRegExp buddyRx("^.+=\\d+$");
+    QRegExp scheduleRx("^\\d{1,2}:\\d{2}-\\d{1,2}:\\d{2}=\\d+$");
+    for (int i = 0; i < args.count(); i++)
+    {
+        QString name = args.at(i).section('=', 0, 0);
+        if ((name != "--limit") && (name != "--buddy-limit") && (name != "--schedule")) continue;
+
+        QString value;
+        if (args.at(i).contains('='))
+            value = args.takeAt(i).section('=', 1);
+        else if (i + 1 < args.count()) {
+            args.removeAt(i);
+            value = args.takeAt(i);
+        }
+        else
+            return false;
+        i--;
+
+        bool ok = true;
+        if (name == "--limit") {
+            mLimit = value.toInt(&ok);
+            ok = ok && (mLimit >= 0);
+        }
+        else if (name == "--buddy-limit") {
+            ok = buddyRx.exactMatch(value);
+            mBuddyLimits.append(value);
+        }
+        else {
+            ok = scheduleRx.exactMatch(value);
+            mSchedule.append(value);
+        }
+        if (!ok) {
+            QTextStream(stderr) << "Malformed option: " << name << " " << value << Qt::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+void DuktoDaemon::usage()
+{
+    QTextStream(stderr) << "Usage:" << Qt::endl
+                        << "  dukto --daemon [--dir PATH] [limits]" << Qt::endl
+                        << "  dukto receive [--dir PATH] [limits]" << Qt::endl
+                        << "  dukto send [limits] <buddy name | address[:port] | [IPv6 address]:port>[,<buddy>...] <paths>" << Qt::endl
+                        << "Limits (KB/s, for this run only):" << Qt::endl
+                        << "  --limit KBPS  --buddy-limit BUDDY=KBPS  --schedule HH:MM-HH:MM=KBPS" << Qt::endl;
+}
+
+// A buddy named on the command line, by its name, user, host or address
+bool DuktoDaemon::matchesBuddy(const Peer &peer, const QString &dest)
+{
+    return (QString::compare(peer.name, dest, Qt::CaseInsensitive) == 0)
+        || (QString::compare(peer.user, dest, Qt::CaseInsensitive) == 0)
+        || (QString::compare(peer.host, dest, Qt::CaseInsensitive) == 0)
+        || (peer.address.toString() == dest);
+}
+
+bool DuktoDaemon::start()
+{
+    if (mMode != Send) QDir::setCurrent(mDir);
+
+    // Same settings as the GUI; a one-shot send doesn't take the ports
+    // of a Dukto already running here, it discovers from an ephemeral
+    // port and doesn't listen for transfers
+    if (mMode == Send)
+        mProtocol.setPorts(0, NETWORK_PORT);
+    else
+        mProtocol.setPorts(NETWORK_PORT, NETWORK_PORT);
+    mProtocol.setFanOutBufferBudget(mSettings.fanOutBufferBudget());
+    mProtocol.setPeerExpiry(HELLO_INTERVAL, mSettings.peerExpiryHeartbeats());
+    mProtocol.setLegacyBroadcast(mSettings.legacyBroadcast());
+    mProtocol.setTelemetryLog(mSettings.telemetryLogPath());
+    mProtocol.setInstanceId(mSettings.instanceId());
+    mProtocol.shaper()->setGlobalLimit(mSettings.bandwidthLimit() * 1024);
+    foreach (const QString &entry, mSettings.peerBandwidthLimits())
+        mProtocol.shaper()->setPeerLimit(entry.section('=', 0, 0), entry.section('=', 1, 1).toLongLong() * 1024);
+    mProtocol.shaper()->setSchedule(mSettings.bandwidthSchedule());
+    if (mLimit >= 0) mProtocol.shaper()->setGlobalLimit(mLimit * 1024);
+    if (!mSchedule.isEmpty()) mProtocol.shaper()->setSchedule(mSchedule);
+    foreach (const QString &entry, mBuddyLimits)
+        mProtocol.shaper()->setPeerLimit(entry.section('=', 0, -2), entry.section('=', -1).toLongLong() * 1024);
+    if (!mProtocol.initialize(true, mMode != Send)) {
+        QTextStream(stderr) << "Cannot bind port " << NETWORK_PORT << ", is Dukto already running?" << Qt::endl;
+        return false;
+    }
+    watchQuitSignals();
+
+    if (mMode == Send)
+    {
+        // An address is used as it is, anything else is first looked
+        // up among the buddies, then tried as a host name
+        bool resolved = true;
+        foreach (const QString &dest, mDestinations)
+        {
+            QString ip;
+            qint16 port = 0;
+            if (!parseAddress(dest, &ip, &port)) {
+                ip.clear();
+                resolved = false;
+            }
+            mResolved.append(qMakePair(ip, port));
+        }
+        if (resolved) {
+            startSend();
+            return true;
+        }
+        mResolveTimer.start(RESOLVE_TIMEOUT);
+    }
+    else
+        log("Receiving in " + QDir::currentPath());
+
+    mProtocol.sayHello(QHostAddress::Broadcast);
+    return true;
+}
+
+// Literal addresses, optionally with a port ("[address]:port" for IPv6)
+bool DuktoDaemon::parseAddress(const QString &dest, QString *ip, qint16 *port)
+{
+    *port = 0;
+    if (!QHostAddress(dest).isNull()) {
+        *ip = dest;
+        return true;
+    }
+
+    QRegExp rx("^\\[([^\\]]+)\\](?::([0-9]+))?$|^([^:]+):([0-9]+)$");
+    if (rx.indexIn(dest) == -1) return false;
+    QStringList capt = rx.capturedTexts();
+    *ip = capt[1].isEmpty() ? capt[3] : capt[1];
+    *port = capt[1].isEmpty() ? capt[4].toInt() : capt[2].toInt();
+    return true;
+}
+
+// A single buddy gets a normal transfer, a list the one-to-many send
+void DuktoDaemon::startSend()
+{
+    mResolveTimer.stop();
+    mSendStarted = true;
+
+    QStringList ips;
+    for (int i = 0; i < mResolved.count(); i++)
+        ips.append(mResolved.at(i).first);
+    log("Sending to " + ips.join(", "));
+    if (mResolved.count() == 1)
+        mProtocol.sendFile(mResolved.at(0).first, mResolved.at(0).second, mPaths);
+    else
+        mProtocol.sendFileToMany(mResolved, mPaths);
+}
+
+// The buddies not found by name are tried as host names
+void DuktoDaemon::resolveTimeout()
+{
+    if (mSendStarted) return;
+    for (int i = 0; i < mResolved.count(); i++)
+        if (mResolved.at(i).first.isEmpty())
+            mResolved[i] = qMakePair(mDestinations.at(i), (qint16) 0);
+    startSend();
+}
+
+void DuktoDaemon::peerListAdded(Peer peer)
+{
+    // Limits given by name apply to the buddy's key, like the saved ones
+    foreach (const QString &entry, mBuddyLimits)
+        if (matchesBuddy(peer, entry.section('=', 0, -2)))
+            mProtocol.shaper()->setPeerLimit(DuktoProtocol::peerKey(peer), entry.section('=', -1).toLongLong() * 1024);
+
+    if (mMode != Send) {
+        log("Buddy: " + peer.name + " (" + peer.address.toString() + ")");
+        return;
+    }
+
+    if (mSendStarted) return;
+    bool resolved = true;
+    for (int i = 0; i < mDestinations.count(); i++)
+    {
+        const QString &dest = mDestinations.at(i);
+        if (mResolved.at(i).first.isEmpty() && matchesBuddy(peer, dest))
+            mResolved[i] = qMakePair(peer.address.toString(), peer.port);
+        if (mResolved.at(i).first.isEmpty()) resolved = false;
+    }
+    if (resolved) startSend();
+}
+
+void DuktoDaemon::peerListRemoved(Peer peer)
+{
+    if (mMode != Send) log("Buddy gone: " + peer.name + " (" + peer.address.toString() + ")");
+}
+
+void DuktoDaemon::receiveFileStart(QString senderIp)
+{
+    log("Receiving from " + senderIp);
+}
+
+void DuktoDaemon::receiveFileComplete(QStringList *files, qint64 totalSize)
+{
+    QDir d(".");
+    foreach (const QString &f, *files)
+        log("Received " + d.absoluteFilePath(f));
+    log("Transfer complete, " + QString::number(totalSize) + " bytes");
+    if (mMode == Receive) emit finished(0);
+}
+
+void DuktoDaemon::receiveTextComplete(QString *text, qint64 totalSize)
+{
+    Q_UNUSED(totalSize);
+    log("Received text:");
+    QTextStream(stdout) << *text << Qt::endl;
+    if (mMode == Receive) emit finished(0);
+}
+
+void DuktoDaemon::receiveFileCancelled()
+{
+    log("Transfer cancelled");
+    if (mMode == Receive) emit finished(1);
+}
+
+void DuktoDaemon::sendFileComplete(QStringList *files)
+{
+    Q_UNUSED(files);
+    log("Transfer complete");
+    emit finished(0);
+}
+
+void DuktoDaemon::sendFileError(int code)
+{
+    log("Send error, code " + QString::number(code));
+    emit finished(1);
+}
+
+void DuktoDaemon::sendFileAborted()
+{
+    log("Transfer aborted");
+    emit finished(1);
+}
+
+void DuktoDaemon::fanOutDestinationFailed(QString ip, int code)
+{
+    log("Could not send to " + ip + ", code " + QString::number(code));
+}
+
+void DuktoDaemon::quitRequested()
+{
+    mProtocol.sayGoodbye();
+    emit finished(0);
+}
+
+void DuktoDaemon::log(const QString &message)
+{
+    QTextStream(stdout) << QDateTime::currentDateTime().toString(Qt::ISODate) << " " << message << Qt::endl;
+}
+
+// SIGINT and SIGTERM end the event loop, so that a goodbye is sent
+void DuktoDaemon::watchQuitSignals()
+{
+#if defined(Q_OS_UNIX)
+    if (pipe(quitPipe) != 0) return;
+    QSocketNotifier *n = new QSocketNotifier(quitPipe[0], QSocketNotifier::Read, this);
+    connect(n, SIGNAL(activated(int)), this, SLOT(quitRequested()));
+    signal(SIGINT, quitSignalHandler);
+    signal(SIGTERM, quitSignalHandler);
+#endif
+}
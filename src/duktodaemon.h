@@ -0,0 +1,96 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2011 Emanuele Colombo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef DUKTODAEMON_H
+#define DUKTODAEMON_H
+
+#include <QObject>
+#include <QStringList>
+#include <QTimer>
+
+#include "duktoprotocol.h"
+#include "settings.h"
+
+// Headless entry points, for machines without a display:
+//  - dukto --daemon [--dir PATH]           discovery and receive, forever
+//  - dukto receive [--dir PATH]            waits for a single transfer
+//  - dukto send <buddy>[,<buddy>...] <paths>
+//                                          sends files and folders, to several
+//                                          buddies at once with a list
+// Every command also takes --limit, --buddy-limit and --schedule, rate
+// limits for that run only.
+// Only DuktoProtocol runs, on a QCoreApplication: no QML, widgets or clipboard.
+class DuktoDaemon : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit DuktoDaemon(QObject *parent = nullptr);
+    static bool isHeadlessCommand(int argc, char *argv[]);
+    bool configure(const QStringList &args);
+    bool start();
+
+signals:
+    void finished(int code);
+
+private slots:
+    void peerListAdded(Peer peer);
+    void peerListRemoved(Peer peer);
+    void receiveFileStart(QString senderIp);
+    void receiveFileComplete(QStringList *files, qint64 totalSize);
+    void receiveTextComplete(QString *text, qint64 totalSize);
+    void receiveFileCancelled();
+    void sendFileComplete(QStringList *files);
+    void sendFileError(int code);
+    void sendFileAborted();
+    void fanOutDestinationFailed(QString ip, int code);
+    void resolveTimeout();
+    void quitRequested();
+
+private:
+    enum Mode {
+        Daemon,
+        Receive,
+        Send
+    };
+
+    bool takeBandwidthOptions(QStringList &args);
+    static bool matchesBuddy(const Peer &peer, const QString &dest);
+    bool parseAddress(const QString &dest, QString *ip, qint16 *port);
+    void startSend();
+    void log(const QString &message);
+    void usage();
+    void watchQuitSignals();
+
+    DuktoProtocol mProtocol;
+    Settings mSettings;
+    Mode mMode;
+    QString mDir;                   // Where received files are saved
+    QStringList mDestinations;      // Buddy names, addresses or hosts to send to
+    QList<QPair<QString, qint16> > mResolved;   // Address of each destination, empty ip if not found yet
+    QStringList mPaths;             // Elements to send
+    QTimer mResolveTimer;           // Wait for the buddy to show up by name
+    bool mSendStarted;
+
+    // Rate limits from the command line
+    int mLimit;                     // KB/s, -1 to keep the saved one
+    QStringList mBuddyLimits;       // "buddy=KBps"
+    QStringList mSchedule;          // "HH:MM-HH:MM=KBps", replaces the saved schedule
+};
+
+#endif // DUKTODAEMON_H
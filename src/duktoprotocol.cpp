@@ -23,41 +23,178 @@
 #include <QDir>
 #include <QNetworkInterface>
 #include <QTimer>
+#include <QtEndian>
+#include <QRandomGenerator>
+#include <QDateTime>
+#include <QVariantMap>
+#include <QCryptographicHash>
+#include <QUuid>
+
+#include <string.h>
+#include <algorithm>
+
+#if defined(Q_OS_UNIX)
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+#if defined(Q_OS_LINUX)
+#include <sys/socket.h>
+#include <netinet/in.h>
+#endif
 
 #include "platform.h"
+#include "fanoutsender.h"
+#include "framing.h"
+#include "networkinterfacemonitor.h"
+#include "tracer.h"
 
 #define DEFAULT_UDP_PORT 4644
 #define DEFAULT_TCP_PORT 4644
+#define DEFAULT_FANOUT_BUFFER_BUDGET (16 * 1048576)
+// Discovery groups: administratively scoped IPv4 and link-local IPv6
+#define MULTICAST_GROUP_IPV4 "239.255.46.44"
+#define MULTICAST_GROUP_IPV6 "ff02::4644"
+
+#define DEFAULT_HEARTBEAT_INTERVAL 60000
+#define DEFAULT_MISSED_HEARTBEATS 3
+
+// Presence: every buddy sends a small heartbeat, the interval grows with
+// the number of buddies so that the whole segment stays around
+// HEARTBEAT_SEGMENT_RATE heartbeats per second. A silent buddy is probed
+// with unicast hellos before being removed.
+//  - Heartbeat: type 0x06, port (u16), interval in ms (u32), identity tag (u32)
+#define HEARTBEAT_SIZE 11
+#define HEARTBEAT_SEGMENT_RATE 20
+#define HEARTBEAT_MIN_INTERVAL 5000
+#define HEARTBEAT_MAX_INTERVAL 60000
+#define HEARTBEAT_JITTER 10
+#define DEPARTURE_CHECK_INTERVAL 1000
+#define DEPARTURE_PROBE_INTERVAL 2000
+#define DEPARTURE_PROBES 2
+
+// Peer cache: buddies of the previous sessions are listed at startup
+// as unverified, probed a few times and dropped if they don't answer
+#define PEER_CACHE_MAX_AGE (7 * 24 * 3600)
+#define PEER_CACHE_MAX_ENTRIES 1024
+#define PEER_CACHE_PROBE_INTERVAL 3000
+#define PEER_CACHE_PROBES 3
+
+// Replies to broadcast hellos are delayed by a random time and
+// sent together; when many buddies are waiting for a reply, a single
+// broadcast answers all of them
+#define HELLO_REPLY_JITTER 1000
+#define HELLO_REPLY_COALESCE 4
+
+#define HELLO_TRAILER_VERSION 2
+#define HELLO_FIELD_MAX 255
+
+// Discovery receive buffer: a slot for each datagram of a batch.
+// Hello messages are far smaller than a slot, longer datagrams are dropped.
+#define UDP_SLOT_SIZE 2048
+#define UDP_BATCH_SIZE 32
+#define UDP_MAX_BATCHES 16
 
 DuktoProtocol::DuktoProtocol()
-	: mSocket(nullptr), mTcpServer(nullptr), mCurrentSocket(nullptr),
-		mCurrentFile(nullptr), mFilesToSend(nullptr)
+	: mSocket(nullptr), mSocket6(nullptr), mTcpServer(nullptr), mCurrentSocket(nullptr), mInterfaces(nullptr),
+		mCurrentFile(nullptr), mFilesToSend(nullptr), mFanOut(nullptr)
 {
     mLocalUdpPort = DEFAULT_UDP_PORT;
     mLocalTcpPort = DEFAULT_TCP_PORT;
 
     mIsSending = false;
     mIsReceiving = false;
-    mSendingScreen = false;
+    mScreenOffset = -1;
+    mThrottled = false;
+    mTraceConnect = -1;
+    mFanOutBufferBudget = DEFAULT_FANOUT_BUFFER_BUDGET;
+    mCurrentPeerPort = 0;
+    mTransferCaps = 0;
+    mSendV2 = false;
+    mAwaitingHandshake = false;
+    mFrameRemaining = 0;
+    mRecvEnded = false;
+    mDataExtentEnd = 0;
+    connect(&mProgress, SIGNAL(progress(qint64,qint64,qint64,int)), this, SIGNAL(transferStatusUpdate(qint64,qint64,qint64,int)));
+
+    mHeartbeatInterval = DEFAULT_HEARTBEAT_INTERVAL;
+    mMissedHeartbeats = DEFAULT_MISSED_HEARTBEATS;
+    mPeerClock.start();
+    mInstanceId = QUuid::createUuid().toRfc4122();
+    mIdentityTag = 0;
+    mHeartbeatTimer = new QTimer(this);
+    mHeartbeatTimer->setSingleShot(true);
+    connect(mHeartbeatTimer, SIGNAL(timeout()), this, SLOT(sendHeartbeat()));
+    mExpiryTimer = new QTimer(this);
+    connect(mExpiryTimer, SIGNAL(timeout()), this, SLOT(expirePeers()));
+    mLastBroadcastHello = -1;
+    mLegacyBroadcast = true;
+    mProbeRounds = 0;
+    mReplyTimer = new QTimer(this);
+    mReplyTimer->setSingleShot(true);
+    connect(mReplyTimer, SIGNAL(timeout()), this, SLOT(sendPendingReplies()));
+
+    mHandshakeTimer = new QTimer(this);
+    mHandshakeTimer->setSingleShot(true);
+    mHandshakeTimer->setInterval(V2_HANDSHAKE_TIMEOUT);
+    connect(mHandshakeTimer, SIGNAL(timeout()), this, SLOT(handshakeTimeout()));
 }
 
 DuktoProtocol::~DuktoProtocol()
 {
     if (mCurrentSocket) delete mCurrentSocket;
     if (mSocket) delete mSocket;
+    if (mSocket6) delete mSocket6;
     if (mTcpServer) delete mTcpServer;
     if (mCurrentFile) delete mCurrentFile;
+    if (mFanOut) delete mFanOut;
 }
 
-void DuktoProtocol::initialize()
+// Without discovery nothing is sent on the LAN and only local
+// transfers are accepted (benchmarks). Without receive there's no
+// transfer server (one-shot senders); a UDP port of 0 then means an
+// ephemeral one, announced in the hellos so that replies come back.
+// Returns false if a port couldn't be bound.
+bool DuktoProtocol::initialize(bool discovery, bool receive)
 {
+    refreshIdentity();
+    if (!discovery)
+    {
+        if (!receive) return true;
+        mTcpServer = new QTcpServer(this);
+        connect(mTcpServer, SIGNAL(newConnection()), this, SLOT(newIncomingConnection()));
+        return mTcpServer->listen(QHostAddress::LocalHost, mLocalTcpPort);
+    }
+
+    mInterfaces = new NetworkInterfaceMonitor(this);
+    mUdpBuffer.resize(UDP_SLOT_SIZE * UDP_BATCH_SIZE);
     mSocket = new QUdpSocket(this);
-    mSocket->bind(QHostAddress::Any, mLocalUdpPort);
+    bool bound = mSocket->bind(QHostAddress::AnyIPv4, mLocalUdpPort);
+    if (bound && (mLocalUdpPort == 0)) mLocalUdpPort = mSocket->localPort();
     connect(mSocket, SIGNAL(readyRead()), this, SLOT(newUdpData()));
 
-    mTcpServer = new QTcpServer(this);
-    mTcpServer->listen(QHostAddress::Any, mLocalTcpPort);
-    connect(mTcpServer, SIGNAL(newConnection()), this, SLOT(newIncomingConnection()));
+    // IPv6 discovery, if the host has IPv6 at all
+    mSocket6 = new QUdpSocket(this);
+    if (mSocket6->bind(QHostAddress::AnyIPv6, mLocalUdpPort))
+        connect(mSocket6, SIGNAL(readyRead()), this, SLOT(newUdpData()));
+    else
+    {
+        delete mSocket6;
+        mSocket6 = nullptr;
+    }
+    joinMulticastGroups();
+    connect(mInterfaces, SIGNAL(interfacesChanged()), this, SLOT(joinMulticastGroups()));
+
+    if (receive)
+    {
+        mTcpServer = new QTcpServer(this);
+        if (!mTcpServer->listen(QHostAddress::Any, mLocalTcpPort)) bound = false;
+        connect(mTcpServer, SIGNAL(newConnection()), this, SLOT(newIncomingConnection()));
+    }
+
+    mExpiryTimer->start(DEPARTURE_CHECK_INTERVAL);
+    mHeartbeatTimer->start(heartbeatInterval());
+    return bound;
 }
 
 void DuktoProtocol::setPorts(qint16 udp, qint16 tcp)
@@ -66,15 +203,297 @@ void DuktoProtocol::setPorts(qint16 udp, qint16 tcp)
     mLocalTcpPort = tcp;
 }
 
+// Buddies to remember for the next session, most recent first
+QVariantList DuktoProtocol::exportPeerCache()
+{
+    QList<Peer> peers;
+    foreach (const Peer &p, mPeers.values())
+        if (p.verified) peers.append(p);
+    std::sort(peers.begin(), peers.end(), [](const Peer &a, const Peer &b) { return a.lastSeen > b.lastSeen; });
+
+    QVariantList cache;
+    QDateTime now = QDateTime::currentDateTimeUtc();
+    qint64 clock = mPeerClock.elapsed();
+    for (int i = 0; (i < peers.size()) && (i < PEER_CACHE_MAX_ENTRIES); i++)
+    {
+        QVariantMap entry;
+        entry["address"] = peers.at(i).address.toString();
+        entry["port"] = peers.at(i).port;
+        entry["name"] = peers.at(i).name;
+        entry["lastSeen"] = now.addMSecs(peers.at(i).lastSeen - clock);
+        cache.append(entry);
+    }
+    return cache;
+}
+
+// Lists the cached buddies right away, waiting for them to confirm
+// with a targeted hello; it works even where broadcasts are dropped
+void DuktoProtocol::importPeerCache(const QVariantList &cache)
+{
+    QDateTime oldest = QDateTime::currentDateTimeUtc().addSecs(-PEER_CACHE_MAX_AGE);
+    foreach (const QVariant &v, cache)
+    {
+        QVariantMap entry = v.toMap();
+        if (entry.value("lastSeen").toDateTime() < oldest) continue;
+        QHostAddress address(entry.value("address").toString());
+        if (address.isNull() || mPeers.contains(address)) continue;
+
+        Peer p(address, entry.value("name").toString(), entry.value("port").toInt());
+        p.splitLegacyName();
+        p.verified = false;
+        p.lastSeen = mPeerClock.elapsed();
+        insertPeer(p);
+        emit peerListAdded(p);
+    }
+
+    mProbeRounds = 0;
+    probeUnverifiedPeers();
+}
+
+void DuktoProtocol::probeUnverifiedPeers()
+{
+    bool pending = false;
+    QMutableHashIterator<QHostAddress, Peer> i(mPeers);
+    while (i.hasNext())
+    {
+        i.next();
+        if (i.value().verified) continue;
+
+        // No answer after the last probe: it's gone
+        if (mProbeRounds == PEER_CACHE_PROBES)
+        {
+            Peer p = i.value();
+            unindexPeer(p);
+            i.remove();
+            emit peerListRemoved(p);
+            continue;
+        }
+        sendHello(i.key(), i.value().port, true);
+        pending = true;
+    }
+
+    mProbeRounds++;
+    if (pending) QTimer::singleShot(PEER_CACHE_PROBE_INTERVAL, this, SLOT(probeUnverifiedPeers()));
+}
+
+// Membership of the discovery groups on every interface able to multicast.
+// It's renewed when the interfaces change, a new or restarted interface
+// doesn't inherit the memberships.
+void DuktoProtocol::joinMulticastGroups()
+{
+    QHostAddress group4(MULTICAST_GROUP_IPV4);
+    foreach (const QNetworkInterface &iface, mInterfaces->multicastInterfacesIPv4())
+    {
+        mSocket->leaveMulticastGroup(group4, iface);
+        mSocket->joinMulticastGroup(group4, iface);
+    }
+
+    if (!mSocket6) return;
+    QHostAddress group6(MULTICAST_GROUP_IPV6);
+    foreach (const QNetworkInterface &iface, mInterfaces->multicastInterfacesIPv6())
+    {
+        mSocket6->leaveMulticastGroup(group6, iface);
+        mSocket6->joinMulticastGroup(group6, iface);
+    }
+}
+
+// Socket to use to reach an address
+QUdpSocket* DuktoProtocol::socketFor(const QHostAddress &dest)
+{
+    if (mSocket6 && (dest.protocol() == QAbstractSocket::IPv6Protocol)) return mSocket6;
+    return mSocket;
+}
+
+// Every buddy says hello at least once per heartbeat interval (its own
+// periodic hello, or the reply to ours); after the given number of
+// missed heartbeats it's considered gone
+void DuktoProtocol::setPeerExpiry(int heartbeatInterval, int missedHeartbeats)
+{
+    mHeartbeatInterval = qMax(heartbeatInterval, 1000);
+    mMissedHeartbeats = qMax(missedHeartbeats, 1);
+}
+
+// Buddies silent for too long are probed with unicast hellos, a lost
+// heartbeat is not a departure; if they don't answer they're removed
+// as if they said goodbye
+void DuktoProtocol::expirePeers()
+{
+    qint64 now = mPeerClock.elapsed();
+    QMutableHashIterator<QHostAddress, Peer> i(mPeers);
+    while (i.hasNext())
+    {
+        i.next();
+        Peer &p = i.value();
+        if (!p.verified) continue;
+        qint64 interval = p.heartbeatInterval ? p.heartbeatInterval : mHeartbeatInterval;
+        if (now - p.lastSeen <= interval * mMissedHeartbeats) continue;
+        if (now - p.lastProbe < DEPARTURE_PROBE_INTERVAL) continue;
+
+        if (p.probes < DEPARTURE_PROBES)
+        {
+            sendHello(i.key(), p.port, true);
+            p.probes++;
+            p.lastProbe = now;
+            continue;
+        }
+
+        Peer gone = p;
+        unindexPeer(gone);
+        i.remove();
+        emit peerListRemoved(gone);
+    }
+}
+
+// Interval between our heartbeats, it grows with the buddies on the segment
+int DuktoProtocol::heartbeatInterval()
+{
+    qint64 ms = (qint64) (mPeers.size() + 1) * 1000 / HEARTBEAT_SEGMENT_RATE;
+    return qBound((qint64) HEARTBEAT_MIN_INTERVAL, ms, (qint64) HEARTBEAT_MAX_INTERVAL);
+}
+
+void DuktoProtocol::sendHeartbeat()
+{
+    int interval = heartbeatInterval();
+
+    uchar packet[HEARTBEAT_SIZE];
+    packet[0] = 0x06;                   // 0x06 -> HEARTBEAT
+    qToBigEndian<quint16>(mLocalUdpPort, packet + 1);
+    qToBigEndian<quint32>(interval, packet + 3);
+    qToBigEndian<quint32>(mIdentityTag, packet + 7);
+    QByteArray *heartbeat = new QByteArray((char*) packet, sizeof(packet));
+    sendToAllBroadcast(heartbeat, mLocalUdpPort);
+    if (mLocalUdpPort != DEFAULT_UDP_PORT) sendToAllBroadcast(heartbeat, DEFAULT_UDP_PORT);
+    delete heartbeat;
+
+    // Buddies that don't know heartbeats still need a hello now and then
+    qint64 now = mPeerClock.elapsed();
+    if (now - mLastBroadcastHello >= mHeartbeatInterval)
+        foreach (const Peer &p, mPeers)
+            if (!(p.caps & CapHeartbeat)) {
+                announce();
+                break;
+            }
+
+    // Random spread, so that the buddies don't end up in step
+    int jitter = interval * HEARTBEAT_JITTER / 100;
+    mHeartbeatTimer->start(interval - jitter + QRandomGenerator::global()->bounded(2 * jitter + 1));
+}
+
 QString DuktoProtocol::getSystemSignature()
 {
-    static QString signature = "";
-    if (signature != "") return signature;
+    return mSignature;
+}
 
-    signature = Platform::getSystemUsername()
-              + " at " + Platform::getHostname()
-              + " (" + Platform::getPlatformName() + ")";
-    return signature;
+void DuktoProtocol::setInstanceId(const QByteArray &id)
+{
+    mInstanceId = id;
+
+    // Before initialize() there's nothing to refresh, it builds the identity itself
+    if (mSocket) refreshIdentity();
+}
+
+// Short digest of a hello payload: a heartbeat with a different tag
+// means that the identity of the buddy changed. It's computed for
+// every hello, so it's a 32 bit FNV-1a over the received bytes in
+// place, no hash object or result buffer is allocated.
+static quint32 identityTag(const char *payload, int size)
+{
+    quint32 h = 2166136261u;
+    for (int i = 0; i < size; i++)
+    {
+        h ^= (uchar) payload[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Builds once the identity part of the hello messages, it only
+// changes when the buddy name or the avatar changes
+void DuktoProtocol::refreshIdentity()
+{
+    Peer me;
+    me.user = Platform::getSystemUsername();
+    me.host = Platform::getHostname();
+    me.platform = Platform::getPlatformName();
+    me.name = me.user + " at " + me.host + " (" + me.platform + ")";
+    me.caps = localCapabilities();
+    me.instanceId = mInstanceId;
+    QFile avatar(Platform::getAvatarPath());
+    if (avatar.open(QIODevice::ReadOnly))
+        me.avatarHash = QCryptographicHash::hash(avatar.readAll(), QCryptographicHash::Md5);
+
+    mSignature = me.name;
+    mHelloPayload = helloPayload(me);
+    mIdentityTag = identityTag(mHelloPayload.constData(), mHelloPayload.size());
+}
+
+static void appendField(QByteArray &a, const QByteArray &field)
+{
+    int size = qMin(field.size(), HELLO_FIELD_MAX);
+    a.append((char) size);
+    a.append(field.constData(), size);
+}
+
+// Hello payload: the legacy "user at host (platform)" name, then after
+// a NUL (old clients stop reading the name there) a versioned trailer:
+//  - Trailer version (u8)
+//  - Capabilities (u32)                               from version 1
+//  - User, host, platform, avatar hash, instance ID,
+//    each one as length (u8) and bytes                from version 2
+// Newer versions can only append fields.
+QByteArray DuktoProtocol::helloPayload(const Peer &identity)
+{
+    QByteArray payload = identity.name.toUtf8();
+    uchar caps[4];
+    qToBigEndian<quint32>(identity.caps, caps);
+    payload.append('\0');
+    payload.append((char) HELLO_TRAILER_VERSION);
+    payload.append((char*) caps, sizeof(caps));
+    appendField(payload, identity.user.toUtf8());
+    appendField(payload, identity.host.toUtf8());
+    appendField(payload, identity.platform.toUtf8());
+    appendField(payload, identity.avatarHash);
+    appendField(payload, identity.instanceId);
+    return payload;
+}
+
+// Reads a hello payload straight from the datagram buffer. Without the
+// version 2 fields, user, host and platform come from the legacy name.
+void DuktoProtocol::parseHelloPayload(const char *data, int size, Peer &peer)
+{
+    const char *nul = (const char*) memchr(data, '\0', size);
+    int nameSize = nul ? (nul - data) : size;
+    peer.name = QString::fromUtf8(data, nameSize);
+
+    const uchar *p = (const uchar*) data + nameSize + 1;
+    const uchar *end = (const uchar*) data + size;
+    if (!nul || (end - p < 5) || (p[0] < 1))
+    {
+        peer.splitLegacyName();
+        return;
+    }
+    int version = p[0];
+    peer.caps = qFromBigEndian<quint32>(p + 1);
+    p += 5;
+
+    const char *field[5];
+    int length[5];
+    for (int i = 0; i < 5; i++)
+    {
+        if ((version < 2) || (p >= end) || (end - p - 1 < p[0]))
+        {
+            peer.splitLegacyName();
+            return;
+        }
+        length[i] = p[0];
+        field[i] = (const char*) p + 1;
+        p += 1 + length[i];
+    }
+    peer.user = QString::fromUtf8(field[0], length[0]);
+    peer.host = QString::fromUtf8(field[1], length[1]);
+    peer.platform = QString::fromUtf8(field[2], length[2]);
+    peer.avatarHash = QByteArray(field[3], length[3]);
+    peer.instanceId = QByteArray(field[4], length[4]);
 }
 
 void DuktoProtocol::sayHello(QHostAddress dest)
@@ -84,24 +503,43 @@ void DuktoProtocol::sayHello(QHostAddress dest)
 
 void DuktoProtocol::sayHello(QHostAddress dest, qint16 port)
 {
+    sendHello(dest, port, dest == QHostAddress::Broadcast);
+}
+
+// Broadcast hello that doesn't ask for replies: every buddy
+// announces itself periodically, so nobody needs to answer
+void DuktoProtocol::announce()
+{
+    sendHello(QHostAddress::Broadcast, mLocalUdpPort, false);
+}
+
+// Only the "broadcast" hello types make the receivers reply, the
+// "unicast" ones can be broadcast to announce without soliciting
+void DuktoProtocol::sendHello(QHostAddress dest, qint16 port, bool solicitReplies)
+{
+    // Not initialized yet, the first hello is sent by then
+    if (!mSocket) return;
+    TraceSpan span("discovery", "send hello");
+    if (dest == QHostAddress::Broadcast) mLastBroadcastHello = mPeerClock.elapsed();
+
     // Preparazione pacchetto
     QByteArray *packet = new QByteArray();
     if ((port == DEFAULT_UDP_PORT) && (mLocalUdpPort == DEFAULT_UDP_PORT))
     {
-        if (dest == QHostAddress::Broadcast)
+        if (solicitReplies)
             packet->append(0x01);           // 0x01 -> HELLO MESSAGE (broadcast)
         else
             packet->append(0x02);           // 0x02 -> HELLO MESSAGE (unicast)
     }
     else
     {
-        if (dest == QHostAddress::Broadcast)
+        if (solicitReplies)
             packet->append(0x04);           // 0x04 -> HELLO MESSAGE (broadcast) with PORT
         else
             packet->append(0x05);           // 0x05 -> HELLO MESSAGE (unicast) with PORT
         packet->append((char*)&mLocalUdpPort, sizeof(qint16));
     }
-    packet->append(getSystemSignature());
+    packet->append(mHelloPayload);
 
     // Invio pacchetto
     if (dest == QHostAddress::Broadcast) {
@@ -109,13 +547,15 @@ void DuktoProtocol::sayHello(QHostAddress dest, qint16 port)
         if (port != DEFAULT_UDP_PORT) sendToAllBroadcast(packet, DEFAULT_UDP_PORT);
     }
     else
-        mSocket->writeDatagram(packet->data(), packet->length(), dest, port);
+        socketFor(dest)->writeDatagram(packet->data(), packet->length(), dest, port);
 
     delete packet;
 }
 
 void DuktoProtocol::sayGoodbye()
 {
+    if (!mSocket) return;
+
     // Create packet
     QByteArray *packet = new QByteArray();
     packet->append(0x03);               // 0x03 -> GOODBYE MESSAGE
@@ -137,52 +577,340 @@ void DuktoProtocol::sayGoodbye()
     delete packet;
 }
 
+// Datagrams are read into the preallocated slots of mUdpBuffer and
+// parsed in place, without allocating anything for each packet
 void DuktoProtocol::newUdpData()
 {
-    while (mSocket->hasPendingDatagrams()) {
-        QByteArray datagram;
-        const int maxLength = 65536;  // Theoretical max length in IPv4
-        datagram.resize(maxLength);
-        // datagram.resize(mSocket->pendingDatagramSize());
-        QHostAddress sender;
-        quint16 senderPort;
-        int size = mSocket->readDatagram(datagram.data(), datagram.size(), &sender, &senderPort);
-        datagram.resize(size);
-        handleMessage(datagram, sender);
-     }
+    QUdpSocket *socket = qobject_cast<QUdpSocket*>(sender());
+    if (!socket) socket = mSocket;
+    QHostAddress from;
+    quint16 fromPort;
+
+    // The first datagram is read through Qt, this re-enables its
+    // read notifier for the next burst. Datagrams larger than a slot
+    // would be cut, they're read and dropped.
+    qint64 pending = socket->pendingDatagramSize();
+    qint64 size = socket->readDatagram(mUdpBuffer.data(), UDP_SLOT_SIZE, &from, &fromPort);
+    if ((size > 0) && (pending <= UDP_SLOT_SIZE)) handleMessage(mUdpBuffer.constData(), size, from);
+
+#if defined(Q_OS_LINUX)
+    // Then the rest of the burst, a batch of datagrams for each system call.
+    // The batches are limited, the notifier fires again for what's left.
+    struct mmsghdr msgs[UDP_BATCH_SIZE];
+    struct iovec iovecs[UDP_BATCH_SIZE];
+    struct sockaddr_storage addrs[UDP_BATCH_SIZE];
+    int fd = socket->socketDescriptor();
+    for (int batch = 0; batch < UDP_MAX_BATCHES; batch++)
+    {
+        memset(msgs, 0, sizeof(msgs));
+        for (int i = 0; i < UDP_BATCH_SIZE; i++)
+        {
+            iovecs[i].iov_base = mUdpBuffer.data() + i * UDP_SLOT_SIZE;
+            iovecs[i].iov_len = UDP_SLOT_SIZE;
+            msgs[i].msg_hdr.msg_iov = &iovecs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        }
+
+        int n = ::recvmmsg(fd, msgs, UDP_BATCH_SIZE, MSG_DONTWAIT, nullptr);
+        if (n <= 0) break;
+        for (int i = 0; i < n; i++)
+        {
+            if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) continue;
+            from.setAddress((struct sockaddr*) &addrs[i]);
+
+            // Link-local senders can only be answered through their interface
+            if ((addrs[i].ss_family == AF_INET6) && ((struct sockaddr_in6*) &addrs[i])->sin6_scope_id)
+                from.setScopeId(QNetworkInterface::interfaceNameFromIndex(((struct sockaddr_in6*) &addrs[i])->sin6_scope_id));
+            handleMessage(mUdpBuffer.constData() + i * UDP_SLOT_SIZE, msgs[i].msg_len, from);
+        }
+        if (n < UDP_BATCH_SIZE) break;
+    }
+#else
+    while (socket->hasPendingDatagrams())
+    {
+        pending = socket->pendingDatagramSize();
+        size = socket->readDatagram(mUdpBuffer.data(), UDP_SLOT_SIZE, &from, &fromPort);
+        if ((size > 0) && (pending <= UDP_SLOT_SIZE)) handleMessage(mUdpBuffer.constData(), size, from);
+    }
+#endif
+}
+
+// Same buddy, recognized by the instance ID or by the name for the
+// legacy format
+static bool sameBuddy(const Peer &a, const Peer &b)
+{
+    if (!a.instanceId.isEmpty() && !b.instanceId.isEmpty()) return a.instanceId == b.instanceId;
+    return a.name == b.name;
+}
+
+// New or changed entries go through here, the indexes follow mPeers;
+// removed ones must be unindexed first
+void DuktoProtocol::insertPeer(const Peer &peer)
+{
+    QHash<QHostAddress, Peer>::iterator old = mPeers.find(peer.address);
+    if (old != mPeers.end()) unindexPeer(old.value());
+    mPeers.insert(peer.address, peer);
+    indexPeer(peer);
+}
+
+void DuktoProtocol::indexPeer(const Peer &peer)
+{
+    if (!peer.instanceId.isEmpty()) mPeersById.insert(peer.instanceId, peer.address);
+    if ((peer.address.protocol() == QAbstractSocket::IPv4Protocol) && peer.identityTag)
+        mIPv4ByTag.insert(peer.identityTag, peer.address);
+}
+
+void DuktoProtocol::unindexPeer(const Peer &peer)
+{
+    if (!peer.instanceId.isEmpty()) mPeersById.remove(peer.instanceId, peer.address);
+    if ((peer.address.protocol() == QAbstractSocket::IPv4Protocol) && peer.identityTag)
+        mIPv4ByTag.remove(peer.identityTag, peer.address);
+}
+
+// A buddy heard again, with the identity it already had
+void DuktoProtocol::touchPeer(Peer &peer)
+{
+    peer.lastSeen = mPeerClock.elapsed();
+    peer.probes = 0;
+    if (!peer.verified)
+    {
+        peer.verified = true;
+        emit peerListAdded(peer);
+    }
+}
+
+// Hellos of a dual stack buddy arrive both over IPv4 and IPv6; the
+// IPv4 entry, if there's one, stays the only one in the buddy list.
+// Only the legacy format, without instance ID, needs a full scan.
+bool DuktoProtocol::refreshByHello(const Peer &hello)
+{
+    if (!hello.instanceId.isEmpty())
+    {
+        foreach (const QHostAddress &a, mPeersById.values(hello.instanceId))
+            if (a.protocol() == QAbstractSocket::IPv4Protocol)
+            {
+                touchPeer(mPeers[a]);
+                return true;
+            }
+        return false;
+    }
+
+    QMutableHashIterator<QHostAddress, Peer> i(mPeers);
+    while (i.hasNext())
+    {
+        i.next();
+        if ((i.key().protocol() == QAbstractSocket::IPv4Protocol) && sameBuddy(i.value(), hello))
+        {
+            touchPeer(i.value());
+            return true;
+        }
+    }
+    return false;
+}
+
+// The IPv6 hello of a dual stack buddy came first: its entry gives way
+// to the IPv4 one
+void DuktoProtocol::removeIPv6Entries(const Peer &hello)
+{
+    QList<QHostAddress> gone;
+    if (!hello.instanceId.isEmpty())
+    {
+        foreach (const QHostAddress &a, mPeersById.values(hello.instanceId))
+            if (a.protocol() == QAbstractSocket::IPv6Protocol) gone.append(a);
+    }
+    else
+    {
+        QHashIterator<QHostAddress, Peer> i(mPeers);
+        while (i.hasNext())
+        {
+            i.next();
+            if ((i.key().protocol() == QAbstractSocket::IPv6Protocol) && sameBuddy(i.value(), hello))
+                gone.append(i.key());
+        }
+    }
+
+    foreach (const QHostAddress &a, gone)
+    {
+        Peer p = mPeers.take(a);
+        unindexPeer(p);
+        emit peerListRemoved(p);
+    }
+}
+
+// Same as above, for the heartbeats
+bool DuktoProtocol::refreshByIdentity(quint32 tag, qint32 interval)
+{
+    QHash<quint32, QHostAddress>::const_iterator i = mIPv4ByTag.constFind(tag);
+    if (i == mIPv4ByTag.constEnd()) return false;
+    Peer &p = mPeers[i.value()];
+    p.lastSeen = mPeerClock.elapsed();
+    p.heartbeatInterval = interval;
+    p.probes = 0;
+    return true;
+}
+
+// The reply to a broadcast hello waits for a random time, so that a
+// new buddy isn't hit by every host of the segment at once
+void DuktoProtocol::scheduleReply(const QHostAddress &dest, qint16 port)
+{
+    PendingReply &r = mPendingReplies[dest];
+    r.port = port;
+    r.requested = mPeerClock.elapsed();
+    if (!mReplyTimer->isActive())
+        mReplyTimer->start(QRandomGenerator::global()->bounded(HELLO_REPLY_JITTER));
+}
+
+void DuktoProtocol::sendPendingReplies()
+{
+    QHash<qint16, QList<QHostAddress> > byPort;
+    QHashIterator<QHostAddress, PendingReply> i(mPendingReplies);
+    while (i.hasNext())
+    {
+        i.next();
+
+        // A broadcast hello of ours went out after the request, it's already answered
+        if (i.value().requested < mLastBroadcastHello) continue;
+        byPort[i.value().port].append(i.key());
+    }
+    mPendingReplies.clear();
+
+    QHashIterator<qint16, QList<QHostAddress> > p(byPort);
+    while (p.hasNext())
+    {
+        p.next();
+        if (p.value().size() >= HELLO_REPLY_COALESCE)
+            sendHello(QHostAddress::Broadcast, p.key(), false);
+        else
+            foreach (const QHostAddress &dest, p.value())
+                sendHello(dest, p.key(), false);
+    }
+}
+
+// IPv4 senders can show up as IPv4-mapped IPv6 addresses on a dual
+// stack socket, they're stored as plain IPv4 ones
+static QHostAddress peerAddress(const QHostAddress &a)
+{
+    bool ok;
+    quint32 v4 = a.toIPv4Address(&ok);
+    return ok ? QHostAddress(v4) : a;
+}
+
+// Key of a buddy for its rate limit: the instance ID survives address
+// changes, the versions without one are known only by their address
+QString DuktoProtocol::peerKey(const Peer &peer)
+{
+    return peer.instanceId.isEmpty() ? peer.address.toString() : QString(peer.instanceId.toHex());
 }
 
-void DuktoProtocol::handleMessage(QByteArray &data, QHostAddress &sender)
+QString DuktoProtocol::peerKey(const QString &ip)
 {
-    char msgtype = data.at(0);
+    QHostAddress address = peerAddress(QHostAddress(ip));
+    if (!mPeers.contains(address)) return ip;
+    return peerKey(mPeers.value(address));
+}
+
+void DuktoProtocol::handleMessage(const char *data, int size, const QHostAddress &sender)
+{
+    if (size < 1) return;
+    TraceSpan span("discovery", "packet");
+    span.setArg("type", data[0]);
+    char msgtype = data[0];
+    data++;
+    size--;
+
+    qint16 port = DEFAULT_UDP_PORT;
+    QHostAddress address = peerAddress(sender);
+    Peer hello;
+    QHash<QHostAddress, Peer>::iterator known;
+    qint32 interval;
+    quint32 tag;
+    bool solicited;
 
     switch(msgtype)
     {
+        case 0x04:  // HELLO (broadcast) with PORT
+        case 0x05:  // HELLO (unicast) with PORT
+            if (size < (int) sizeof(qint16)) return;
+            memcpy(&port, data, sizeof(qint16));
+            data += sizeof(qint16);
+            size -= sizeof(qint16);
+            // fall through
+
         case 0x01:  // HELLO (broadcast)
         case 0x02:  // HELLO (unicast)
-            data.remove(0, 1);
-            if (data != getSystemSignature()) {
-                mPeers[sender.toString()] = Peer(sender, QString::fromUtf8(data), DEFAULT_UDP_PORT);
-                if (msgtype == 0x01) sayHello(sender, DEFAULT_UDP_PORT);
-                emit peerListAdded(mPeers[sender.toString()]);
+            // The same identity as last time, recognized by its tag: the
+            // payload isn't parsed again, the buddy list doesn't change
+            tag = identityTag(data, size);
+            if ((tag == mIdentityTag) && mInterfaces->isLocalAddress(address)) break;
+            solicited = (msgtype == 0x01) || (msgtype == 0x04);
+            known = mPeers.find(address);
+            if ((known != mPeers.end()) && (known->identityTag == tag) && (known->port == port))
+            {
+                touchPeer(known.value());
+                if (solicited) scheduleReply(address, port);
+                break;
+            }
+
+            // A buddy already known by its IPv4 address is kept as it is
+            if ((address.protocol() == QAbstractSocket::IPv6Protocol) && mIPv4ByTag.contains(tag))
+            {
+                touchPeer(mPeers[mIPv4ByTag.value(tag)]);
+                if (solicited) scheduleReply(address, port);
+                break;
             }
+
+            // New buddy, or its identity changed
+            hello = Peer(address, QString(), port);
+            parseHelloPayload(data, size, hello);
+            hello.identityTag = tag;
+
+            // Our own messages, recognized by the instance ID or by the
+            // name for the legacy format. A copied profile brings the
+            // instance ID along, only the same host is really us.
+            if ((hello.instanceId.isEmpty() ? (hello.name == mSignature) : (hello.instanceId == mInstanceId))
+                && mInterfaces->isLocalAddress(address))
+                break;
+
+            if (solicited) scheduleReply(address, port);
+            if ((address.protocol() == QAbstractSocket::IPv6Protocol) && refreshByHello(hello))
+                break;
+            if (address.protocol() == QAbstractSocket::IPv4Protocol)
+                removeIPv6Entries(hello);
+
+            hello.lastSeen = mPeerClock.elapsed();
+            insertPeer(hello);
+            emit peerListAdded(hello);
             break;
 
         case 0x03:  // GOODBYE
-            emit peerListRemoved(mPeers[sender.toString()]);
-            mPeers.remove(sender.toString());
+            if (!mPeers.contains(address)) break;
+            hello = mPeers.take(address);
+            unindexPeer(hello);
+            emit peerListRemoved(hello);
             break;
 
-        case 0x04:  // HELLO (broadcast) with PORT
-        case 0x05:  // HELLO (unicast) with PORT
-            data.remove(0, 1);
-            qint16 port = *((qint16*) data.constData());
-            data.remove(0, 2);
-            if (data != getSystemSignature()) {
-                mPeers[sender.toString()] = Peer(sender, QString::fromUtf8(data), port);
-                if (msgtype == 0x04) sayHello(sender, port);
-                emit peerListAdded(mPeers[sender.toString()]);
+        case 0x06:  // HEARTBEAT
+            if (size < HEARTBEAT_SIZE - 1) break;
+            port = qFromBigEndian<quint16>((const uchar*) data);
+            interval = qBound(HEARTBEAT_MIN_INTERVAL, (int) qFromBigEndian<quint32>((const uchar*) data + 2), HEARTBEAT_MAX_INTERVAL);
+            tag = qFromBigEndian<quint32>((const uchar*) data + 6);
+            if ((tag == mIdentityTag) && mInterfaces->isLocalAddress(address)) break;
+
+            known = mPeers.find(address);
+            if ((known != mPeers.end()) && (known->identityTag == tag))
+            {
+                known->lastSeen = mPeerClock.elapsed();
+                known->heartbeatInterval = interval;
+                known->probes = 0;
+                break;
             }
+            if ((address.protocol() == QAbstractSocket::IPv6Protocol) && refreshByIdentity(tag, interval))
+                break;
+
+            // New buddy, or its identity changed: ask for a full hello
+            sendHello(address, port, true);
             break;
     }
 
@@ -196,6 +924,7 @@ void DuktoProtocol::newIncomingConnection()
     if (!mTcpServer->hasPendingConnections()) return;
 
     // Recupero connessione
+    TraceSpan span("connection", "accept");
     QTcpSocket *s = mTcpServer->nextPendingConnection();
 
     // Se sto già ricevendo o inviando, rifiuto la connessione
@@ -206,15 +935,20 @@ void DuktoProtocol::newIncomingConnection()
     }
 
     // Aggiornamento interfaccia grafica
-    receiveFileStart(s->peerAddress().toString());
+    receiveFileStart(peerAddress(s->peerAddress()).toString());
 
     // Impostazione socket TCP corrente
     mCurrentSocket = s;
+    mCurrentPeerIp = peerAddress(s->peerAddress()).toString();
+    mCurrentPeerKey = peerKey(mCurrentPeerIp);
+    mThrottled = false;
+    mTelemetry.begin(false, mCurrentPeerIp);
 
     // Attesa header della connessione (timeout 10 sec)
     if (!s->waitForReadyRead(10000))
     {
         // Non ho ricevuto l'header della connessione, chiudo
+        finishTelemetry("error");
         mCurrentSocket->close();
         delete mCurrentSocket;
 		mCurrentSocket = nullptr;
@@ -228,18 +962,16 @@ void DuktoProtocol::newIncomingConnection()
     // Inizializzazione variabili
     mIsReceiving = true;
     mTotalReceivedData = 0;
+    mProgress.reset();
     mElementSize = -1;
     mReceivedFiles = new QStringList();
     mRootFolderName = "";
     mRootFolderRenamed = "";
     mReceivingText = false;
-    mRecvStatus = FILENAME;
-
-    // -- Lettura header generale --
-    // Numero entità da ricevere
-    mCurrentSocket->read((char*) &mElementsToReceiveCount, sizeof(qint64));
-    // Dimensione totale
-    mCurrentSocket->read((char*) &mTotalSize, sizeof(qint64));
+    mRecvStatus = PREAMBLE;
+    mFrameRemaining = 0;
+    mRecvEnded = false;
+    mTransferCaps = 0;
 
     // Inizio lettura dati sui file
     readNewData();
@@ -248,22 +980,39 @@ void DuktoProtocol::newIncomingConnection()
 
 // Processo di lettura principale
 void DuktoProtocol::readNewData()
+{
+    TraceSpan span("transfer", "read data");
+    qint64 t = mTelemetry.clock();
+    processReceivedData();
+    mTelemetry.addBusyTime(t);
+}
+
+void DuktoProtocol::processReceivedData()
 {
 
     // Fino a che ci sono dati da leggere
-    while (mCurrentSocket->bytesAvailable() > 0)
+    while (mCurrentSocket && (mCurrentSocket->bytesAvailable() > 0))
     {
 
         // In base allo stato in cui mi trovo leggo quello che mi aspetto
         switch (mRecvStatus)
         {
 
+            case PREAMBLE:
+                if (!readPreamble()) return;
+                break;
+
+            case FRAMES:
+                readFrames();
+                return;
+
             case FILENAME:
         {
             char c;
             while (1) {
                         int ret = mCurrentSocket->read(&c, sizeof(c));
                         if (ret < 1) return;
+                        mTelemetry.addBytes(TransferTelemetry::FileName, 1);
                         if (c == '\0')
                         {
                             mRecvStatus = FILESIZE;
@@ -277,10 +1026,195 @@ void DuktoProtocol::readNewData()
             case FILESIZE:
                 {
                     if (!(mCurrentSocket->bytesAvailable() >= sizeof(qint64))) return;
-            mCurrentSocket->read((char*) &mElementSize, sizeof(qint64));
-            mElementReceivedData = 0;
+                    qint64 size;
+                    mCurrentSocket->read((char*) &size, sizeof(qint64));
+                    mTelemetry.addBytes(TransferTelemetry::FileSize, sizeof(qint64));
                     QString name = QString::fromUtf8(mPartialName);
                     mPartialName.clear();
+                    if (!beginElement(name, size)) return;
+
+                    // Folders and empty elements are already complete
+                    mRecvStatus = (mElementSize == -1) ? FILENAME : DATA;
+                }
+                break;
+
+
+            case DATA:
+                {
+        // Provo a leggere quanto mi serve per finire il file corrente
+        // (o per svuotare il buffer dei dati ricevuti)
+        qint64 s = (mCurrentSocket->bytesAvailable() > (mElementSize - mElementReceivedData))
+                    ? (mElementSize - mElementReceivedData)
+                    : mCurrentSocket->bytesAvailable();
+
+        // Rate limiting: leave the rest in the socket, the bounded
+        // read buffer makes TCP slow down the sender
+        mCurrentSocket->setReadBufferSize(mShaper.isLimited(mCurrentPeerKey) ? 65536 : 0);
+        s = mShaper.allowance(mCurrentPeerKey, s);
+        if (s == 0)
+        {
+            throttle();
+            return;
+        }
+        QByteArray d = mCurrentSocket->read(s);
+        mShaper.consume(mCurrentPeerKey, d.size());
+        mTelemetry.addBytes(TransferTelemetry::Data, d.size());
+        mTelemetry.addChunk();
+
+        // Verifico se ho completato l'elemento corrente
+        if (receiveElementData(d))
+            mRecvStatus = FILENAME;
+    }
+                break;
+
+        }
+    }
+}
+
+// The connection starts either with the v2 handshake or
+// directly with the v1 general header
+bool DuktoProtocol::readPreamble()
+{
+    if (mCurrentSocket->bytesAvailable() < V2_MAGIC_SIZE) return false;
+
+    // v2: reply with the capabilities both ends support
+    if (mCurrentSocket->peek(V2_MAGIC_SIZE) == V2_MAGIC)
+    {
+        if (mCurrentSocket->bytesAvailable() < V2_HANDSHAKE_SIZE) return false;
+        QByteArray hs = mCurrentSocket->read(V2_HANDSHAKE_SIZE);
+        mTransferCaps = localCapabilities() & qFromBigEndian<quint32>((const uchar*) hs.constData() + V2_MAGIC_SIZE + 1);
+        mCurrentSocket->write(handshake(mTransferCaps));
+        mTelemetry.addBytes(TransferTelemetry::Preamble, V2_HANDSHAKE_SIZE);
+        mTelemetry.connected(true);
+        mRecvStatus = FRAMES;
+        return true;
+    }
+
+    // -- Lettura header generale --
+    if (mCurrentSocket->bytesAvailable() < 2 * (qint64) sizeof(qint64)) return false;
+    // Numero entità da ricevere
+    mCurrentSocket->read((char*) &mElementsToReceiveCount, sizeof(qint64));
+    // Dimensione totale
+    mCurrentSocket->read((char*) &mTotalSize, sizeof(qint64));
+    mTelemetry.addBytes(TransferTelemetry::Preamble, 2 * sizeof(qint64));
+    mTelemetry.connected(false);
+    mRecvStatus = FILENAME;
+    return true;
+}
+
+// Processo di lettura dei frame (protocollo v2)
+void DuktoProtocol::readFrames()
+{
+    while (mCurrentSocket && (mCurrentSocket->bytesAvailable() > 0))
+    {
+        // Payload of a data frame, streamed to the current element
+        if (mFrameRemaining > 0)
+        {
+            qint64 s = qMin(mFrameRemaining, mCurrentSocket->bytesAvailable());
+            mCurrentSocket->setReadBufferSize(mShaper.isLimited(mCurrentPeerKey) ? 65536 : 0);
+            s = mShaper.allowance(mCurrentPeerKey, s);
+            if (s == 0)
+            {
+                throttle();
+                return;
+            }
+            if ((mElementSize < 0) || (mElementReceivedData + s > mElementSize))
+            {
+                cancelReceive();
+                return;
+            }
+            QByteArray d = mCurrentSocket->read(s);
+            mShaper.consume(mCurrentPeerKey, d.size());
+            mTelemetry.addBytes(TransferTelemetry::Data, d.size());
+            mTelemetry.addChunk();
+            mFrameRemaining -= d.size();
+            receiveElementData(d);
+            continue;
+        }
+
+        // Frame header
+        if (mCurrentSocket->bytesAvailable() < V2_FRAME_HEADER_SIZE) return;
+        uchar h[V2_FRAME_HEADER_SIZE];
+        mCurrentSocket->peek((char*) h, V2_FRAME_HEADER_SIZE);
+        quint32 length = qFromBigEndian<quint32>(h + 1);
+        if (h[0] == FRAME_DATA)
+        {
+            mCurrentSocket->read((char*) h, V2_FRAME_HEADER_SIZE);
+            mTelemetry.addBytes(TransferTelemetry::Framing, V2_FRAME_HEADER_SIZE);
+            mFrameRemaining = length;
+            continue;
+        }
+
+        // Control frames are processed only when complete, so
+        // a batch of element headers is parsed in a single pass
+        if (length > V2_MAX_CONTROL_FRAME)
+        {
+            cancelReceive();
+            return;
+        }
+        if (mCurrentSocket->bytesAvailable() < V2_FRAME_HEADER_SIZE + length) return;
+        mCurrentSocket->read((char*) h, V2_FRAME_HEADER_SIZE);
+        QByteArray payload = mCurrentSocket->read(length);
+        mTelemetry.addBytes(TransferTelemetry::Framing, V2_FRAME_HEADER_SIZE);
+
+        switch (h[0])
+        {
+            case FRAME_SESSION:
+                if (payload.size() < 16)
+                {
+                    cancelReceive();
+                    return;
+                }
+                mElementsToReceiveCount = readInt64(payload.constData());
+                mTotalSize = readInt64(payload.constData() + 8);
+                mTelemetry.addBytes(TransferTelemetry::Preamble, payload.size());
+                break;
+
+            case FRAME_ELEMENT:
+                if (payload.size() < 8)
+                {
+                    cancelReceive();
+                    return;
+                }
+                mTelemetry.addBytes(TransferTelemetry::FileSize, 8);
+                mTelemetry.addBytes(TransferTelemetry::FileName, payload.size() - 8);
+                if (!beginElement(QString::fromUtf8(payload.constData() + 8, payload.size() - 8), readInt64(payload.constData())))
+                    return;
+                break;
+
+            case FRAME_END:
+                mRecvEnded = true;
+                closedConnection();
+                return;
+
+            case FRAME_ABORT:
+                cancelReceive();
+                return;
+
+            case FRAME_HOLE:
+                mTelemetry.addBytes(TransferTelemetry::Framing, payload.size());
+                if ((payload.size() < 8) || !receiveHole(readInt64(payload.constData())))
+                {
+                    cancelReceive();
+                    return;
+                }
+                break;
+
+            default:
+                // Frames added by later versions are skipped
+                break;
+        }
+    }
+}
+
+// Inizio di un nuovo elemento (cartella, file o testo)
+bool DuktoProtocol::beginElement(QString name, qint64 size)
+{
+    mElementSize = size;
+    mElementReceivedData = 0;
+    mTelemetry.addElement();
+    TraceSpan span("protocol", "element header");
+    span.setArg("size", size);
 
             // Se l'elemento corrente è una cartella, la creo e passo all'elemento successivo
             if (mElementSize == -1)
@@ -301,38 +1235,21 @@ void DuktoProtocol::readNewData()
                     mRootFolderRenamed = name;
                     mReceivedFiles->append(name);
 
-                }
-
-                // Se invece l'ho già trattata, allora rinomino questo percorso
-                else if (mRootFolderName != mRootFolderRenamed)
-                    name = name.replace(0, name.indexOf('/'), mRootFolderRenamed);
-
-                // Creo la cartella
-                QDir dir(".");
-                        bool ret = dir.mkpath(name);
-                        if (!ret)
-                        {
-                            emit receiveFileCancelled();
-                            // Chiusura socket
-                            if (mCurrentSocket)
-                            {
-                                mCurrentSocket->disconnect();
-                                mCurrentSocket->disconnectFromHost();
-                                mCurrentSocket->close();
-                                mCurrentSocket->deleteLater();
-								mCurrentSocket = nullptr;
-                            }
-
-                            // Rilascio memoria
-                            delete mReceivedFiles;
-							mReceivedFiles = nullptr;
+                }
 
-                            // Impostazione stato
-                            mIsReceiving = false;
-                            return;
+                // Se invece l'ho già trattata, allora rinomino questo percorso
+                else if (mRootFolderName != mRootFolderRenamed)
+                    name = name.replace(0, name.indexOf('/'), mRootFolderRenamed);
+
+                // Creo la cartella
+                QDir dir(".");
+                        bool ret = dir.mkpath(name);
+                        if (!ret)
+                        {
+                            cancelReceive();
+                            return false;
                         }
-                        mRecvStatus = FILENAME;
-                        break;
+                        return true;
             }
 
             // Potrebbe essere un invio di testo
@@ -364,67 +1281,107 @@ void DuktoProtocol::readNewData()
                         bool ret = mCurrentFile->open(QIODevice::WriteOnly);
                         if (!ret)
                         {
-                            emit receiveFileCancelled();
-                            // Chiusura socket
-                            if (mCurrentSocket)
-                            {
-                                mCurrentSocket->disconnect();
-                                mCurrentSocket->disconnectFromHost();
-                                mCurrentSocket->close();
-                                mCurrentSocket->deleteLater();
-								mCurrentSocket = nullptr;
-            }
-
-                            // Rilascio memoria
-                            delete mReceivedFiles;
-							mReceivedFiles = nullptr;
-
-                            // Impostazione stato
-                            mIsReceiving = false;
-                            return;
-        }
+                            cancelReceive();
+                            return false;
+                        }
                         mReceivingText = false;
-                    }
-                    mRecvStatus = DATA;
-                }
-                break;
+            }
 
+    // Un elemento vuoto è già completo
+    if (mElementSize == 0) endElement();
+    return true;
+}
 
-            case DATA:
-                {
-        // Provo a leggere quanto mi serve per finire il file corrente
-        // (o per svuotare il buffer dei dati ricevuti)
-        qint64 s = (mCurrentSocket->bytesAvailable() > (mElementSize - mElementReceivedData))
-                    ? (mElementSize - mElementReceivedData)
-                    : mCurrentSocket->bytesAvailable();
-        QByteArray d = mCurrentSocket->read(s);
+// Salva i dati ricevuti per l'elemento corrente; restituisce
+// true se l'elemento è stato completato
+bool DuktoProtocol::receiveElementData(const QByteArray &d)
+{
         mElementReceivedData += d.size();
         mTotalReceivedData += d.size();
         updateStatus();
 
         // Salvo i dati letti
         if (!mReceivingText)
+        {
+            TraceSpan diskSpan("disk", "write");
+            diskSpan.setArg("bytes", d.size());
+            qint64 t = mTelemetry.clock();
             mCurrentFile->write(d);
+            mTelemetry.addDiskTime(t);
+        }
         else
             mTextToReceive.append(d);
 
         // Verifico se ho completato l'elemento corrente
-        if (mElementReceivedData == mElementSize)
-        {
-            // Completato, chiudo il file e mi preparo per il prossimo elemento
+        if (mElementReceivedData != mElementSize) return false;
+        endElement();
+        return true;
+}
+
+// Hole in a sparse file: nothing is written, the file position just
+// moves past it. A hole at the end of the file is made by resizing it.
+bool DuktoProtocol::receiveHole(qint64 length)
+{
+    if (!mCurrentFile || mReceivingText || (length < 0) || (mElementReceivedData + length > mElementSize))
+        return false;
+
+    mElementReceivedData += length;
+    mTotalReceivedData += length;
+    updateStatus();
+    if (!mCurrentFile->seek(mElementReceivedData)) return false;
+
+    if (mElementReceivedData == mElementSize)
+    {
+        if (!mCurrentFile->resize(mElementSize)) return false;
+        endElement();
+    }
+    return true;
+}
+
+// Completato, chiudo il file e mi preparo per il prossimo elemento
+void DuktoProtocol::endElement()
+{
             mElementSize = -1;
-            if (!mReceivingText)
+            if (!mReceivingText && mCurrentFile)
             {
                 mCurrentFile->deleteLater();
 				mCurrentFile = nullptr;
             }
-                        mRecvStatus = FILENAME;
-        }
-    }
-                break;
+}
 
-        }
+// Interrompe la ricezione in corso in caso di errore
+void DuktoProtocol::cancelReceive()
+{
+    finishTelemetry("cancelled");
+    emit receiveFileCancelled();
+
+    // Chiusura ed eliminazione del file parziale
+    if (mCurrentFile)
+    {
+        QString name = mCurrentFile->fileName();
+        bool wasOpen = mCurrentFile->isOpen();
+        mCurrentFile->close();
+        delete mCurrentFile;
+        mCurrentFile = nullptr;
+        if (wasOpen) QFile::remove(name);
     }
+
+                            // Chiusura socket
+                            if (mCurrentSocket)
+                            {
+                                mCurrentSocket->disconnect();
+                                mCurrentSocket->disconnectFromHost();
+                                mCurrentSocket->close();
+                                mCurrentSocket->deleteLater();
+								mCurrentSocket = nullptr;
+                            }
+
+                            // Rilascio memoria
+                            delete mReceivedFiles;
+							mReceivedFiles = nullptr;
+
+                            // Impostazione stato
+                            mIsReceiving = false;
 }
 
 void DuktoProtocol::closedConnectionTmp()
@@ -435,8 +1392,18 @@ void DuktoProtocol::closedConnectionTmp()
 // Chiusura della connessione TCP in ricezione
 void DuktoProtocol::closedConnection()
 {
+    if (!mIsReceiving) return;
+
     // Svuoto il buffer in ricezione
     readNewData();
+    if (!mIsReceiving) return;
+
+    // Shaped transfer: the remaining data must still be consumed
+    if (mThrottled && mCurrentSocket && (mCurrentSocket->bytesAvailable() > 0))
+    {
+        QTimer::singleShot(mShaper.msUntilAvailable(mCurrentPeerKey), this, SLOT(closedConnection()));
+        return;
+    }
 
     // Chiusura eventuale file corrente
     if (mCurrentFile)
@@ -447,16 +1414,28 @@ void DuktoProtocol::closedConnection()
         delete mCurrentFile;
 		mCurrentFile = nullptr;
         QFile::remove(name);
+        finishTelemetry("cancelled");
+        receiveFileCancelled();
+    }
+
+    // Stream v2 interrotto prima della fine
+    else if ((mRecvStatus == FRAMES) && !mRecvEnded)
+    {
+        finishTelemetry("cancelled");
         receiveFileCancelled();
     }
 
     // Ricezione file conclusa
     else if (!mReceivingText)
+    {
+        finishTelemetry("complete");
         receiveFileComplete(mReceivedFiles, mTotalSize);
+    }
 
     // Ricezione testo conclusa
     else
     {
+        finishTelemetry("complete");
         QString rec = QString::fromUtf8(mTextToReceive);
         receiveTextComplete(&rec, mTotalSize);
     }
@@ -492,17 +1471,13 @@ void DuktoProtocol::sendFile(QString ipDest, qint16 port, QStringList files)
     // File da inviare
     mFilesToSend = expandTree(files);
     mFileCounter = 0;
+    mTelemetry.begin(true, ipDest);
 
     // Connessione al destinatario
-    mCurrentSocket = new QTcpSocket(this);
-
-    // Gestione segnali
-    connect(mCurrentSocket, SIGNAL(connected()), this, SLOT(sendMetaData()), Qt::DirectConnection);
-    connect(mCurrentSocket, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(sendConnectError(QAbstractSocket::SocketError)), Qt::DirectConnection);
-    connect(mCurrentSocket, SIGNAL(bytesWritten(qint64)), this, SLOT(sendData(qint64)), Qt::DirectConnection);
-
-    // Connessione
-    mCurrentSocket->connectToHost(ipDest, port);
+    mCurrentPeerIp = ipDest;
+    mCurrentPeerKey = peerKey(ipDest);
+    mCurrentPeerPort = port;
+    connectToReceiver();
 }
 
 void DuktoProtocol::sendText(QString ipDest, qint16 port, QString text)
@@ -519,16 +1494,18 @@ void DuktoProtocol::sendText(QString ipDest, qint16 port, QString text)
     mFilesToSend->append("___DUKTO___TEXT___");
     mFileCounter = 0;
     mTextToSend = text;
+    mTelemetry.begin(true, ipDest);
 
     // Connessione al destinatario
-    mCurrentSocket = new QTcpSocket(this);
-    connect(mCurrentSocket, SIGNAL(connected()), this, SLOT(sendMetaData()), Qt::DirectConnection);
-    connect(mCurrentSocket, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(sendConnectError(QAbstractSocket::SocketError)), Qt::DirectConnection);
-    connect(mCurrentSocket, SIGNAL(bytesWritten(qint64)), this, SLOT(sendData(qint64)), Qt::DirectConnection);
-    mCurrentSocket->connectToHost(ipDest, port);
+    mCurrentPeerIp = ipDest;
+    mCurrentPeerKey = peerKey(ipDest);
+    mCurrentPeerPort = port;
+    connectToReceiver();
 }
 
-void DuktoProtocol::sendScreen(QString ipDest, qint16 port, QString path)
+// The screenshot is already encoded in memory: it's sent from there,
+// without a round-trip through a temporary file
+void DuktoProtocol::sendScreen(QString ipDest, qint16 port, QByteArray image, QString format)
 {
     // Check for default port
     if (port == 0) port = DEFAULT_TCP_PORT;
@@ -537,14 +1514,33 @@ void DuktoProtocol::sendScreen(QString ipDest, qint16 port, QString path)
     if (mIsReceiving || mIsSending) return;
     mIsSending = true;
 
-    // File da inviare
-    QStringList files;
-    files.append(path);
-    mFilesToSend = expandTree(files);
+    // Screenshot da inviare
+    mFilesToSend = new QStringList();
+    mFilesToSend->append("___DUKTO___SCREEN___");
     mFileCounter = 0;
-    mSendingScreen = true;
+    mScreenData = image;
+    mScreenName = "Screenshot." + format;
+    mScreenOffset = -1;
+    mTelemetry.begin(true, ipDest);
 
     // Connessione al destinatario
+    mCurrentPeerIp = ipDest;
+    mCurrentPeerKey = peerKey(ipDest);
+    mCurrentPeerPort = port;
+    connectToReceiver();
+}
+
+// Connessione al destinatario del trasferimento corrente
+void DuktoProtocol::connectToReceiver()
+{
+    // The transfer could have been aborted while waiting to reconnect
+    if (!mIsSending || mCurrentSocket) return;
+
+    mThrottled = false;
+    mSendV2 = false;
+    mAwaitingHandshake = false;
+    mTransferCaps = 0;
+    mTraceConnect = Tracer::isEnabled() ? Tracer::now() : -1;
     mCurrentSocket = new QTcpSocket(this);
 
     // Gestione segnali
@@ -553,7 +1549,53 @@ void DuktoProtocol::sendScreen(QString ipDest, qint16 port, QString path)
     connect(mCurrentSocket, SIGNAL(bytesWritten(qint64)), this, SLOT(sendData(qint64)), Qt::DirectConnection);
 
     // Connessione
-    mCurrentSocket->connectToHost(ipDest, port);
+    mCurrentSocket->connectToHost(mCurrentPeerIp, mCurrentPeerPort);
+}
+
+// Sends the same files to several destinations, reading them only once;
+// each one gets the v2 framing if it advertised it
+void DuktoProtocol::sendFileToMany(QList<QPair<QString, qint16> > dests, QStringList files)
+{
+    // Verifica altre attività in corso
+    if (mIsReceiving || mIsSending) return;
+    if (dests.isEmpty()) return;
+    mIsSending = true;
+
+    // File da inviare
+    mFilesToSend = expandTree(files);
+    mFileCounter = 0;
+
+    // Shared sender, one socket for each destination
+    mFanOut = new FanOutSender(mFilesToSend, mBasePath, mFanOutBufferBudget, this);
+    mFanOut->setShaper(&mShaper);
+    mProgress.reset();
+    connect(mFanOut, SIGNAL(transferStatusUpdate(qint64,qint64)), &mProgress, SLOT(update(qint64,qint64)));
+    connect(mFanOut, SIGNAL(destinationFailed(QString,int)), this, SIGNAL(fanOutDestinationFailed(QString,int)));
+    connect(mFanOut, SIGNAL(finished(int)), this, SLOT(fanOutFinished(int)), Qt::QueuedConnection);
+    for (int i = 0; i < dests.count(); i++)
+    {
+        // Every buddy gets the v2 framing if it announced it, like in sendMetaData()
+        QString ip = dests.at(i).first;
+        quint32 caps = mPeers.value(peerAddress(QHostAddress(ip))).caps;
+        mFanOut->addDestination(ip, (dests.at(i).second == 0) ? DEFAULT_TCP_PORT : dests.at(i).second, caps, peerKey(ip));
+    }
+    mFanOut->start();
+}
+
+// All the fan-out destinations have completed or failed
+void DuktoProtocol::fanOutFinished(int succeeded)
+{
+    if (!mFanOut) return;
+    mFanOut->deleteLater();
+    mFanOut = nullptr;
+    mIsSending = false;
+
+    if (succeeded > 0)
+        emit sendFileComplete(mFilesToSend);
+    else
+        emit sendFileError(QAbstractSocket::RemoteHostClosedError);
+    delete mFilesToSend;
+    mFilesToSend = nullptr;
 }
 
 void DuktoProtocol::sendMetaData()
@@ -564,6 +1606,60 @@ void DuktoProtocol::sendMetaData()
 	//::setsockopt(mCurrentSocket->socketDescriptor(), SOL_SOCKET, SO_SNDBUF, (char*)&v, sizeof(v));
 #endif
 
+    // The receiver announced the v2 framing: agree on the
+    // capabilities before sending anything else
+    if (mPeers.value(peerAddress(QHostAddress(mCurrentPeerIp))).caps & CapFramingV2)
+    {
+        mAwaitingHandshake = true;
+        connect(mCurrentSocket, SIGNAL(readyRead()), this, SLOT(readHandshakeReply()), Qt::DirectConnection);
+        mTelemetry.addBytes(TransferTelemetry::Preamble, V2_HANDSHAKE_SIZE);
+        mCurrentSocket->write(handshake(localCapabilities()));
+        mHandshakeTimer->start();
+        return;
+    }
+
+    sendSessionHeader();
+}
+
+// Risposta del destinatario all'handshake v2
+void DuktoProtocol::readHandshakeReply()
+{
+    if (!mAwaitingHandshake || !mCurrentSocket) return;
+    if (mCurrentSocket->bytesAvailable() < V2_HANDSHAKE_SIZE) return;
+    QByteArray hs = mCurrentSocket->read(V2_HANDSHAKE_SIZE);
+    if (!hs.startsWith(V2_MAGIC))
+    {
+        handshakeTimeout();
+        return;
+    }
+
+    mHandshakeTimer->stop();
+    mAwaitingHandshake = false;
+    mTransferCaps = localCapabilities() & qFromBigEndian<quint32>((const uchar*) hs.constData() + V2_MAGIC_SIZE + 1);
+    mSendV2 = true;
+    sendSessionHeader();
+}
+
+// The receiver didn't answer the handshake: it's treated as
+// a v1 peer from now on and the transfer starts again
+void DuktoProtocol::handshakeTimeout()
+{
+    if (!mAwaitingHandshake || !mCurrentSocket) return;
+    mHandshakeTimer->stop();
+    mAwaitingHandshake = false;
+    QHostAddress address = peerAddress(QHostAddress(mCurrentPeerIp));
+    if (mPeers.contains(address))
+        mPeers[address].caps &= ~CapFramingV2;
+
+    mCurrentSocket->disconnect();
+    mCurrentSocket->abort();
+    mCurrentSocket->deleteLater();
+    mCurrentSocket = nullptr;
+    QTimer::singleShot(V2_FALLBACK_DELAY, this, SLOT(connectToReceiver()));
+}
+
+void DuktoProtocol::sendSessionHeader()
+{
     // Header
     //  - N. entità (file, cartelle, ecc...)
     //  - Dimensione totale
@@ -572,24 +1668,43 @@ void DuktoProtocol::sendMetaData()
 
     QByteArray header;
     qint64 tmp;
+    mTelemetry.connected(mSendV2);
+    if (mTraceConnect >= 0) {
+        Tracer::complete("connection", "setup", mTraceConnect, Tracer::now() - mTraceConnect, "v2", mSendV2);
+        mTraceConnect = -1;
+    }
 
     // N. entità
     tmp = mFilesToSend->count();
-    header.append((char*) &tmp, sizeof(tmp));
     // Dimensione totale
     mTotalSize = computeTotalSize(mFilesToSend);
-    header.append((char*) &mTotalSize, sizeof(mTotalSize));
+    if (mSendV2)
+    {
+        QByteArray payload;
+        appendInt64(payload, tmp);
+        appendInt64(payload, mTotalSize);
+        header.append(frame(FRAME_SESSION, payload));
+    }
+    else
+    {
+        header.append((char*) &tmp, sizeof(tmp));
+        header.append((char*) &mTotalSize, sizeof(mTotalSize));
+    }
+
+    mTelemetry.addBytes(TransferTelemetry::Preamble, header.size());
 
     // Primo elemento
-    header.append(nextElementHeader());
+    header.append(nextElementHeaders());
 
     // Invio header
     mCurrentSocket->write(header);
+    mTelemetry.wrote();
 
     // Inizializzazione variabili
     mTotalSize += header.size();
     mSentData = 0;
     mSentBuffer = 0;
+    mProgress.reset();
 
     // Aggiornamento interfaccia utente
     updateStatus();
@@ -599,6 +1714,9 @@ void DuktoProtocol::sendData(qint64 b)
 {
     QByteArray d;
 
+    // The stream starts after the handshake
+    if (mAwaitingHandshake || !mCurrentSocket) return;
+
     // Aggiornamento statistiche
     mSentData += b;
     updateStatus();
@@ -610,44 +1728,141 @@ void DuktoProtocol::sendData(qint64 b)
     // Se ci sono altri dati da inviare, attendo
     // che vengano inviati
     if (mSentBuffer > 0) return;
+    mTelemetry.drained();
+    TraceSpan span("transfer", "chunk write");
 
     // Se si tratta di un invio testuale, butto dentro
     // tutto il testo
     if ((!mTextToSend.isEmpty()) && (mFilesToSend->at(mFileCounter - 1) == "___DUKTO___TEXT___"))
     {
         d.append(mTextToSend.toUtf8().data());
+        mTelemetry.addBytes(TransferTelemetry::Data, d.size());
+        mTelemetry.addChunk();
+        if (mSendV2)
+        {
+            d = frame(FRAME_DATA, d);
+            mTotalSize += V2_FRAME_HEADER_SIZE;
+            mTelemetry.addBytes(TransferTelemetry::Framing, V2_FRAME_HEADER_SIZE);
+        }
         mCurrentSocket->write(d);
+        mTelemetry.wrote();
+        span.setArg("bytes", d.size());
         mSentBuffer = d.size();
         mTextToSend.clear();
         return;
     }
 
+    // Screenshot: a new piece of the in-memory image
+    if (mScreenOffset >= 0)
+    {
+        qint64 wanted = qMin((qint64) (mSendV2 ? V2_CHUNK_SIZE : 10000), mScreenData.size() - mScreenOffset);
+        qint64 chunk = mShaper.allowance(mCurrentPeerKey, wanted);
+        if ((chunk == 0) && (wanted > 0))
+        {
+            throttle();
+            return;
+        }
+        d = mScreenData.mid(mScreenOffset, chunk);
+        mShaper.consume(mCurrentPeerKey, d.size());
+        mScreenOffset += d.size();
+        if (d.size() == 0) mScreenOffset = -1;
+    }
+
     // Se il file corrente non è ancora terminato
     // invio una nuova parte del file
-    if (mCurrentFile)
-        d = mCurrentFile->read(10000);
+    else if (mCurrentFile)
+    {
+        qint64 wanted = mSendV2 ? V2_CHUNK_SIZE : 10000;
+
+        // Sparse file: the holes aren't read, only their length is sent
+        if (mTransferCaps & CapSparse)
+        {
+            qint64 hole = skipHole();
+            if (hole > 0)
+            {
+                QByteArray payload;
+                appendInt64(payload, hole);
+                d = frame(FRAME_HOLE, payload);
+                mTotalSize += d.size() - hole;
+                mTelemetry.addBytes(TransferTelemetry::Framing, d.size());
+                mCurrentSocket->write(d);
+                mTelemetry.wrote();
+                mSentBuffer = d.size();
+                return;
+            }
+            wanted = qMin(wanted, mDataExtentEnd - mCurrentFile->pos());
+        }
+
+        qint64 chunk = mShaper.allowance(mCurrentPeerKey, wanted);
+        if ((chunk == 0) && !mCurrentFile->atEnd())
+        {
+            throttle();
+            return;
+        }
+        TraceSpan diskSpan("disk", "read");
+        qint64 t = mTelemetry.clock();
+        d = mCurrentFile->read(chunk);
+        mTelemetry.addDiskTime(t);
+        mShaper.consume(mCurrentPeerKey, d.size());
+    }
     if (d.size() > 0)
     {
+        mTelemetry.addBytes(TransferTelemetry::Data, d.size());
+        mTelemetry.addChunk();
+        if (mSendV2)
+        {
+            d = frame(FRAME_DATA, d);
+            mTotalSize += V2_FRAME_HEADER_SIZE;
+            mTelemetry.addBytes(TransferTelemetry::Framing, V2_FRAME_HEADER_SIZE);
+        }
         mCurrentSocket->write(d);
+        mTelemetry.wrote();
+        span.setArg("bytes", d.size());
         mSentBuffer = d.size();
         return;
     }
 
     // Altrimenti chiudo il file e passo al prossimo
-    d.append(nextElementHeader());
+    d.append(nextElementHeaders());
 
     // Non ci sono altri file da inviare?
     if (d.size() == 0)
     {
+        if (mSendV2)
+        {
+            mCurrentSocket->write(frame(FRAME_END, QByteArray()));
+            mTelemetry.addBytes(TransferTelemetry::Framing, V2_FRAME_HEADER_SIZE);
+        }
         closeCurrentTransfer();
         return;
     }
 
     // Invio l'header insime al primo chunk di file
+    // (a sparse file could start with a hole, its data waits for the next round)
     mTotalSize += d.size();
-    if (mCurrentFile)
-        d.append(mCurrentFile->read(10000));
+    if (mCurrentFile && !(mTransferCaps & CapSparse))
+    {
+        TraceSpan diskSpan("disk", "read");
+        qint64 t = mTelemetry.clock();
+        QByteArray chunk = mCurrentFile->read(mShaper.allowance(mCurrentPeerKey, mSendV2 ? V2_CHUNK_SIZE : 10000));
+        mTelemetry.addDiskTime(t);
+        mShaper.consume(mCurrentPeerKey, chunk.size());
+        if (chunk.size() > 0)
+        {
+            mTelemetry.addBytes(TransferTelemetry::Data, chunk.size());
+            mTelemetry.addChunk();
+        }
+        if (mSendV2 && (chunk.size() > 0))
+        {
+            chunk = frame(FRAME_DATA, chunk);
+            mTotalSize += V2_FRAME_HEADER_SIZE;
+            mTelemetry.addBytes(TransferTelemetry::Framing, V2_FRAME_HEADER_SIZE);
+        }
+        d.append(chunk);
+    }
     mCurrentSocket->write(d);
+    mTelemetry.wrote();
+    span.setArg("bytes", d.size());
     mSentBuffer += d.size();
 
     return;
@@ -656,20 +1871,32 @@ void DuktoProtocol::sendData(qint64 b)
 // Chiusura trasferimento dati
 void DuktoProtocol::closeCurrentTransfer(bool aborted)
 {
-    mCurrentSocket->disconnect();
-    mCurrentSocket->disconnectFromHost();
-    if (mCurrentSocket->state() != QTcpSocket::UnconnectedState)
-        mCurrentSocket->waitForDisconnected(1000);
-    mCurrentSocket->close();
-    mCurrentSocket->deleteLater();
-	mCurrentSocket = nullptr;
+    mHandshakeTimer->stop();
+    mAwaitingHandshake = false;
+    if (mCurrentSocket)
+    {
+        // A v2 receiver is told explicitly that the stream is incomplete
+        if (aborted && mSendV2)
+            mCurrentSocket->write(frame(FRAME_ABORT, QByteArray()));
+        mCurrentSocket->disconnect();
+        mCurrentSocket->disconnectFromHost();
+        if (mCurrentSocket->state() != QTcpSocket::UnconnectedState)
+            mCurrentSocket->waitForDisconnected(1000);
+        mCurrentSocket->close();
+        mCurrentSocket->deleteLater();
+		mCurrentSocket = nullptr;
+    }
+    mSendV2 = false;
     if (mCurrentFile)
     {
         mCurrentFile->close();
         delete mCurrentFile;
 		mCurrentFile = nullptr;
     }
+    mScreenData.clear();
+    mScreenOffset = -1;
     mIsSending = false;
+    finishTelemetry(aborted ? "aborted" : "complete");
     if (!aborted)
         emit sendFileComplete(mFilesToSend);
     delete mFilesToSend;
@@ -678,18 +1905,53 @@ void DuktoProtocol::closeCurrentTransfer(bool aborted)
     return;
 }
 
+// Waits for the rate limiter before moving more data
+void DuktoProtocol::throttle()
+{
+    if (mThrottled) return;
+    mThrottled = true;
+    mTelemetry.throttled();
+    QTimer::singleShot(mShaper.msUntilAvailable(mCurrentPeerKey), this, SLOT(resumeThrottled()));
+}
+
+void DuktoProtocol::resumeThrottled()
+{
+    if (!mThrottled) return;
+    mThrottled = false;
+    mTelemetry.resumed();
+    if (!mCurrentSocket) return;
+
+    if (mIsSending)
+        sendData(0);
+    else if (mIsReceiving)
+        readNewData();
+}
+
+// Closes the timing record of the session, then logs and emits it
+void DuktoProtocol::finishTelemetry(const QString &result)
+{
+    if (!mTelemetry.isActive()) return;
+    mTelemetry.finish(result);
+    if (!mTelemetryLog.isEmpty())
+        TransferTelemetry::appendToLog(mTelemetryLog, mTelemetry.toJson());
+    emit transferTelemetry(mTelemetry);
+}
+
 // Aggiornamento delle statistiche di invio
 void DuktoProtocol::updateStatus()
 {
     if (mIsSending)
-        emit transferStatusUpdate(mTotalSize, mSentData);
+        mProgress.update(mTotalSize, mSentData);
     else if (mIsReceiving)
-        emit transferStatusUpdate(mTotalSize, mTotalReceivedData);
+        mProgress.update(mTotalSize, mTotalReceivedData);
 }
 
 // In caso di errore di connessione
 void DuktoProtocol::sendConnectError(QAbstractSocket::SocketError e)
 {
+    mHandshakeTimer->stop();
+    mAwaitingHandshake = false;
+    mSendV2 = false;
     if (mCurrentSocket)
     {
         mCurrentSocket->close();
@@ -702,7 +1964,10 @@ void DuktoProtocol::sendConnectError(QAbstractSocket::SocketError e)
         delete mCurrentFile;
 		mCurrentFile = nullptr;
     }
+    mScreenData.clear();
+    mScreenOffset = -1;
     mIsSending = false;
+    finishTelemetry("error");
     sendFileError(e);
 }
 
@@ -751,6 +2016,7 @@ QByteArray DuktoProtocol::nextElementHeader()
     // Ricava il nome del file (se non è l'ultimo)
     if (mFilesToSend->size() == mFileCounter) return header;
     QString fullname = mFilesToSend->at(mFileCounter++);
+    TraceSpan span("protocol", "element header");
 
     // Chiusura file precedente, se non è già stato chiuso
     if (mCurrentFile) {
@@ -760,41 +2026,98 @@ QByteArray DuktoProtocol::nextElementHeader()
     }
 
     // Verifico se si tratta di un invio testo
-    if (fullname == "___DUKTO___TEXT___") {
-        header.append(fullname + '\0');
-        qint64 size = mTextToSend.toUtf8().length();
-        header.append((char*) &size, sizeof(size));
-        return header;
-    }
-
-    // Nome elemento
-    QString name;
+    if (fullname == "___DUKTO___TEXT___")
+        return elementHeader(fullname.toUtf8(), mTextToSend.toUtf8().length());
 
     // Verifico se si tratta di un invio screen
-    if (mSendingScreen) {
-
-        name = "Screenshot.jpg";
-        mSendingScreen = false;
+    if (fullname == "___DUKTO___SCREEN___") {
+        mScreenOffset = 0;
+        return elementHeader(mScreenName.toUtf8(), mScreenData.size());
     }
-    else
-        name = fullname;
+
+    // Nome elemento
+    QString name = fullname;
 
     // Aggiunta nome file all'header
     name.replace(mBasePath + "/", "");
-    header.append(name.toUtf8() + '\0');
 
     // Dimensione elemento
     qint64 size = -1;
     QFileInfo fi2(fullname);
     if (fi2.isFile()) size = fi2.size();
-    header.append((char*) &size, sizeof(size));
+    header = elementHeader(name.toUtf8(), size);
 
     // Apertura file
+    // (unbuffered for sparse files, their extents are looked up on the descriptor)
     if (size > -1) {
         mCurrentFile = new QFile(fullname);
-        mCurrentFile->open(QIODevice::ReadOnly);
+        mCurrentFile->open((mTransferCaps & CapSparse) ? (QIODevice::ReadOnly | QIODevice::Unbuffered) : QIODevice::ReadOnly);
+        mDataExtentEnd = 0;
+    }
+
+    return header;
+}
+
+// When the current file position is at the start of a hole, moves past
+// it and returns its length; it also finds where the following data
+// extent ends. Without SEEK_DATA/SEEK_HOLE the whole file is one extent.
+qint64 DuktoProtocol::skipHole()
+{
+    qint64 pos = mCurrentFile->pos();
+    qint64 size = mCurrentFile->size();
+    if ((pos >= size) || (pos < mDataExtentEnd)) return 0;
+
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    int fd = mCurrentFile->handle();
+    off_t data = ::lseek(fd, pos, SEEK_DATA);
+    if (data == (off_t) -1)
+        data = (errno == ENXIO) ? size : pos;     // ENXIO: only a hole up to the end
+    off_t hole = (data < size) ? ::lseek(fd, data, SEEK_HOLE) : size;
+    if (hole == (off_t) -1) hole = size;
+
+    // Qt keeps its own idea of the position
+    mCurrentFile->seek(data);
+    mDataExtentEnd = hole;
+    return data - pos;
+#else
+    mDataExtentEnd = size;
+    return 0;
+#endif
+}
+
+// Header of the next element, followed by the ones of the elements
+// without data (folders and empty files), sent all together
+QByteArray DuktoProtocol::nextElementHeaders()
+{
+    QByteArray headers = nextElementHeader();
+    while ((headers.size() > 0) && (headers.size() < V2_CHUNK_SIZE)
+           && mTextToSend.isEmpty() && (!mCurrentFile || (mCurrentFile->size() == 0)))
+    {
+        QByteArray next = nextElementHeader();
+        if (next.size() == 0) break;
+        headers.append(next);
     }
+    return headers;
+}
 
+// Header di un elemento
+//  - v1: nome, '\0', dimensione
+//  - v2: frame con dimensione e nome
+QByteArray DuktoProtocol::elementHeader(const QByteArray &name, qint64 size)
+{
+    QByteArray header;
+    mTelemetry.addElement();
+    mTelemetry.addBytes(TransferTelemetry::FileName, name.size() + (mSendV2 ? 0 : 1));
+    mTelemetry.addBytes(TransferTelemetry::FileSize, sizeof(qint64));
+    if (mSendV2) mTelemetry.addBytes(TransferTelemetry::Framing, V2_FRAME_HEADER_SIZE);
+    if (mSendV2)
+    {
+        appendInt64(header, size);
+        header.append(name);
+        return frame(FRAME_ELEMENT, header);
+    }
+    header.append(name + '\0');
+    header.append((char*) &size, sizeof(size));
     return header;
 }
 
@@ -805,6 +2128,10 @@ qint64 DuktoProtocol::computeTotalSize(QStringList *e)
     if ((e->length() == 1) && (e->at(0) == "___DUKTO___TEXT___"))
         return mTextToSend.toUtf8().length();
 
+    // Screenshot in memoria
+    if ((e->length() == 1) && (e->at(0) == "___DUKTO___SCREEN___"))
+        return mScreenData.size();
+
     // Se è un invio normale
     qint64 size = 0;
     for (int i = 0; i < e->count(); i++)
@@ -818,31 +2145,70 @@ qint64 DuktoProtocol::computeTotalSize(QStringList *e)
 // Invia un pacchetto a tutti gli indirizzi broadcast del PC
 void DuktoProtocol::sendToAllBroadcast(QByteArray *packet, qint16 port)
 {
-    // Elenco interfacce disponibili
-    QList<QNetworkInterface> ifaces = QNetworkInterface::allInterfaces();
+    // Invio pacchetto per ogni IP di broadcast
+    // (the table is cached, it's built again only when the interfaces change;
+    // broadcast is still needed by the versions without multicast)
+    if (mLegacyBroadcast && broadcastNeeded())
+    {
+        const QList<QHostAddress> &broadcasts = mInterfaces->broadcastAddresses();
+        for (int i = 0; i < broadcasts.size(); i++)
+        {
+            mSocket->writeDatagram(packet->data(), packet->length(), broadcasts.at(i), port);
+            mSocket->flush();
+        }
+    }
 
-    // Iterazione sulle interfacce
-    for (int i = 0; i < ifaces.size(); i++)
+    // Discovery groups, on every interface
+    QHostAddress group4(MULTICAST_GROUP_IPV4);
+    foreach (const QNetworkInterface &iface, mInterfaces->multicastInterfacesIPv4())
     {
-        // Iterazione per tutti gli IP dell'interfaccia
-        QList<QNetworkAddressEntry> addrs = ifaces[i].addressEntries();
+        mSocket->setMulticastInterface(iface);
+        mSocket->writeDatagram(packet->data(), packet->length(), group4, port);
+    }
 
-        // Invio pacchetto per ogni IP di broadcast
-        for (int j = 0; j < addrs.size(); j++)
-            if ((addrs[j].ip().protocol() == QAbstractSocket::IPv4Protocol) && (addrs[j].broadcast().toString() != ""))
-            {
-                mSocket->writeDatagram(packet->data(), packet->length(), addrs[j].broadcast(), port);
-                mSocket->flush();
-            }
+    if (!mSocket6) return;
+    foreach (const QNetworkInterface &iface, mInterfaces->multicastInterfacesIPv6())
+    {
+        QHostAddress group6(MULTICAST_GROUP_IPV6);
+        group6.setScopeId(iface.name());
+        mSocket6->writeDatagram(packet->data(), packet->length(), group6, port);
     }
 }
 
+// Broadcast reaches only the IPv4 buddies multicast already reaches, unless
+// one of them doesn't listen to the groups. With no buddies yet it's still
+// sent, a version without multicast would never see our hellos; one that
+// shows up later is heard through its own broadcast hello.
+bool DuktoProtocol::broadcastNeeded()
+{
+    bool any = false;
+    foreach (const Peer &p, mPeers)
+    {
+        if (p.address.protocol() != QAbstractSocket::IPv4Protocol) continue;
+        if (!(p.caps & CapMulticast)) return true;
+        any = true;
+    }
+    return !any;
+}
+
 // Interrompe un trasferimento in corso (utilizzabile solo lato invio)
 void DuktoProtocol::abortCurrentTransfer()
 {
     // Check if it's sending data
     if (!mIsSending) return;
 
+    // Abort a one-to-many send
+    if (mFanOut) {
+        mFanOut->abort();
+        mFanOut->deleteLater();
+        mFanOut = nullptr;
+        mIsSending = false;
+        delete mFilesToSend;
+        mFilesToSend = nullptr;
+        emit sendFileAborted();
+        return;
+    }
+
     // Abort current connection
     closeCurrentTransfer(true);
     emit sendFileAborted();
@@ -853,7 +2219,8 @@ void DuktoProtocol::updateBuddyName()
 {
     // Invio pacchetto di disconnessione
     sayGoodbye();
+    refreshIdentity();
 
     // Invio pacchetto di annuncio con il nuovo nome
-    sayHello(QHostAddress::Broadcast, true);
+    sayHello(QHostAddress::Broadcast);
 }
@@ -26,26 +26,61 @@
 #include <QtNetwork/QTcpServer>
 #include <QtNetwork/QHostInfo>
 #include <QHash>
+#include <QPair>
 #include <QFile>
+#include <QElapsedTimer>
+#include <QVariantList>
 
 #include "peer.h"
+#include "bandwidthshaper.h"
+#include "transferprogress.h"
+#include "transfertelemetry.h"
+
+class FanOutSender;
+class NetworkInterfaceMonitor;
+class QTimer;
 
 class DuktoProtocol : public QObject
 {
     Q_OBJECT
 
 public:
+    // Optional features, advertised in the hello message and
+    // negotiated in the v2 handshake
+    enum Capability {
+        CapFramingV2 = 0x0001,
+        CapSparse = 0x0002,         // Holes of sparse files sent as their length
+        CapHeartbeat = 0x0004,      // Presence by heartbeats instead of periodic hellos
+        CapMulticast = 0x0008       // Listens to the discovery multicast groups
+    };
+    static inline quint32 localCapabilities() { return CapFramingV2 | CapSparse | CapHeartbeat | CapMulticast; }
+
     DuktoProtocol();
     virtual ~DuktoProtocol();
-    void initialize();
+    bool initialize(bool discovery = true, bool receive = true);
+    inline bool isDiscovering() { return mInterfaces != nullptr; }
     void setPorts(qint16 udp, qint16 tcp);
+    void setPeerExpiry(int heartbeatInterval, int missedHeartbeats);
     void sayHello(QHostAddress dest);
     void sayHello(QHostAddress dest, qint16 port);
+    void announce();
     void sayGoodbye();
-    inline QHash<QString, Peer>& getPeers() { return mPeers; }
+    inline QHash<QHostAddress, Peer>& getPeers() { return mPeers; }
     void sendFile(QString ipDest, qint16 port, QStringList files);
     void sendText(QString ipDest, qint16 port, QString text);
-    void sendScreen(QString ipDest, qint16 port, QString path);
+    void sendScreen(QString ipDest, qint16 port, QByteArray image, QString format);
+    void sendFileToMany(QList<QPair<QString, qint16> > dests, QStringList files);
+    inline void setFanOutBufferBudget(qint64 bytes) { mFanOutBufferBudget = bytes; }
+    inline BandwidthShaper* shaper() { return &mShaper; }
+    static QString peerKey(const Peer &peer);
+    QString peerKey(const QString &ip);
+    inline void setLegacyBroadcast(bool enabled) { mLegacyBroadcast = enabled; }
+    inline void setTelemetryLog(const QString &path) { mTelemetryLog = path; }
+    void setInstanceId(const QByteArray &id);
+    static QByteArray helloPayload(const Peer &identity);
+    static void parseHelloPayload(const char *data, int size, Peer &peer);
+    QVariantList exportPeerCache();
+    void importPeerCache(const QVariantList &cache);
     inline bool isBusy() { return mIsSending || mIsReceiving; }
     void abortCurrentTransfer();
     void updateBuddyName();
@@ -59,6 +94,16 @@ public slots:
     void sendMetaData();
     void sendData(qint64 b);
     void sendConnectError(QAbstractSocket::SocketError);
+    void fanOutFinished(int succeeded);
+    void resumeThrottled();
+    void connectToReceiver();
+    void readHandshakeReply();
+    void handshakeTimeout();
+    void expirePeers();
+    void sendPendingReplies();
+    void joinMulticastGroups();
+    void probeUnverifiedPeers();
+    void sendHeartbeat();
 
 signals:
      void peerListAdded(Peer peer);
@@ -66,29 +111,83 @@ signals:
      void sendFileComplete(QStringList *files);
      void sendFileError(int code);
      void sendFileAborted();
+     void fanOutDestinationFailed(QString ip, int code);
      void receiveFileStart(QString senderIp);
      void receiveFileComplete(QStringList *files, qint64 totalSize);
      void receiveTextComplete(QString *text, qint64 totalSize);
      void receiveFileCancelled();
-     void transferStatusUpdate(qint64 total, qint64 partial);
+     void transferStatusUpdate(qint64 total, qint64 partial, qint64 bytesPerSecond, int secondsLeft);
+     void transferTelemetry(TransferTelemetry record);
 
 private:
     QString getSystemSignature();
+    void refreshIdentity();
     QStringList* expandTree(QStringList files);
     void addRecursive(QStringList *e, QString path);
     qint64 computeTotalSize(QStringList *e);
     QByteArray nextElementHeader();
+    QByteArray nextElementHeaders();
+    qint64 skipHole();
+    QByteArray elementHeader(const QByteArray &name, qint64 size);
+    void sendSessionHeader();
     void sendToAllBroadcast(QByteArray *packet, qint16 port);
+    bool broadcastNeeded();
     void closeCurrentTransfer(bool aborted = false);
 
-    void handleMessage(QByteArray &data, QHostAddress &sender);
+    void handleMessage(const char *data, int size, const QHostAddress &sender);
+    void sendHello(QHostAddress dest, qint16 port, bool solicitReplies);
+    void scheduleReply(const QHostAddress &dest, qint16 port);
+    void insertPeer(const Peer &peer);
+    void indexPeer(const Peer &peer);
+    void unindexPeer(const Peer &peer);
+    void touchPeer(Peer &peer);
+    bool refreshByHello(const Peer &hello);
+    void removeIPv6Entries(const Peer &hello);
+    bool refreshByIdentity(quint32 tag, qint32 interval);
+    int heartbeatInterval();
+    QUdpSocket* socketFor(const QHostAddress &dest);
     void updateStatus();
+    void throttle();
+    void finishTelemetry(const QString &result);
+    void processReceivedData();
+    bool readPreamble();
+    void readFrames();
+    bool beginElement(QString name, qint64 size);
+    bool receiveElementData(const QByteArray &d);
+    bool receiveHole(qint64 length);
+    void endElement();
+    void cancelReceive();
 
     QUdpSocket *mSocket;            // Socket UDP segnalazione
+    QUdpSocket *mSocket6;           // IPv6 discovery socket (null without IPv6)
+    bool mLegacyBroadcast;          // Also broadcast, for the versions without multicast
+    int mProbeRounds;               // Hellos sent so far to the cached buddies
+    QByteArray mUdpBuffer;          // Slots for a batch of received datagrams
     QTcpServer *mTcpServer;         // Socket TCP attesa dati
     QTcpSocket *mCurrentSocket;     // Socket TCP dell'attuale trasferimento file
-
-    QHash<QString, Peer> mPeers;    // Elenco peer individuati
+    NetworkInterfaceMonitor *mInterfaces;   // Cached broadcast addresses
+    QByteArray mInstanceId;         // Stable ID of this installation
+    QString mSignature;             // Legacy "user at host (platform)" name
+    QByteArray mHelloPayload;       // Identity part of our hello messages
+    quint32 mIdentityTag;           // Digest of mHelloPayload, sent in the heartbeats
+
+    QHash<QHostAddress, Peer> mPeers;   // Elenco peer individuati
+    QMultiHash<QByteArray, QHostAddress> mPeersById;    // Entries of mPeers with an instance ID
+    QMultiHash<quint32, QHostAddress> mIPv4ByTag;       // IPv4 entries of mPeers, by identity tag
+    QElapsedTimer mPeerClock;       // Time base of Peer::lastSeen
+    QTimer *mExpiryTimer;           // Periodic check for buddies gone silent
+    int mHeartbeatInterval;         // ms between two hellos of a buddy without heartbeats
+    int mMissedHeartbeats;          // Missed heartbeats before a buddy is probed
+    QTimer *mHeartbeatTimer;        // Next heartbeat of ours
+
+    // Replies to broadcast hellos
+    struct PendingReply {
+        qint16 port;
+        qint64 requested;           // mPeerClock time of the request
+    };
+    QHash<QHostAddress, PendingReply> mPendingReplies;
+    QTimer *mReplyTimer;            // Random delay before replying
+    qint64 mLastBroadcastHello;     // mPeerClock time of our last broadcast hello
 
     // Send and receive members
     qint16 mLocalUdpPort;
@@ -98,6 +197,16 @@ private:
     QFile *mCurrentFile;            // Puntatore al file aperto corrente
     qint64 mTotalSize;              // Quantit totale di dati da inviare o ricevere
     int mFileCounter;              // Puntatore all'elemento correntemente da trasmettere o ricevere
+    QString mCurrentPeerIp;         // Other end of the current transfer
+    QString mCurrentPeerKey;        // Its peerKey(), for the per-buddy rate limit
+    qint16 mCurrentPeerPort;
+    quint32 mTransferCaps;          // Capabilities negotiated for the current transfer
+    BandwidthShaper mShaper;        // Global and per-peer rate limits
+    TransferProgress mProgress;     // Progress reports, at most 10 per second
+    TransferTelemetry mTelemetry;   // Timing counters of the current session
+    QString mTelemetryLog;          // JSON log of the sessions (empty = no log)
+    qint64 mTraceConnect;           // Tracer time of the connection attempt (-1 = not traced)
+    bool mThrottled;                // Waiting for the rate limiter
 
     // Sending members
     QStringList *mFilesToSend;      // Elenco degli elementi da trasmettere
@@ -105,7 +214,15 @@ private:
     qint64 mSentBuffer;             // Quantit di dati rimanenti nel buffer di trasmissione
     QString mBasePath;              // Percorso base per l'invio di file e cartelle
     QString mTextToSend;            // Testo da inviare (in caso di invio testuale)
-    bool mSendingScreen;            // Flag che indica se si sta inviando uno screenshot
+    QByteArray mScreenData;         // Encoded screenshot, sent straight from memory
+    QString mScreenName;            // Element name of the screenshot
+    qint64 mScreenOffset;           // Bytes of mScreenData already sent (-1 = not sending it)
+    FanOutSender *mFanOut;          // One-to-many send in progress, if any
+    qint64 mFanOutBufferBudget;     // Max bytes buffered for the slowest fan-out destination
+    bool mSendV2;                   // Current transfer uses the v2 framing
+    bool mAwaitingHandshake;        // v2 handshake sent, waiting for the reply
+    QTimer *mHandshakeTimer;        // Fallback to v1 if the reply doesn't come
+    qint64 mDataExtentEnd;          // End of the data extent being sent (sparse files)
 
     // Receive members
     qint64 mElementsToReceiveCount;    // Numero di elementi da ricevere
@@ -118,7 +235,11 @@ private:
     QByteArray mTextToReceive;             // Testo ricevuto in caso di invio testo
     bool mReceivingText;               // Ricezione di testo in corso
     QByteArray mPartialName;              // Nome prossimo file letto solo in parte
+    qint64 mFrameRemaining;            // Bytes still to read of the current v2 data frame
+    bool mRecvEnded;                   // v2 end frame received
     enum RecvStatus {
+        PREAMBLE,
+        FRAMES,
         FILENAME,
         FILESIZE,
         DATA
@@ -0,0 +1,467 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2011 Emanuele Colombo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "fanoutsender.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QTimer>
+
+#include "bandwidthshaper.h"
+#include "duktoprotocol.h"
+#include "framing.h"
+
+#define FANOUT_CHUNK_SIZE 65536
+#define FANOUT_SOCKET_LOW_WATER (2 * FANOUT_CHUNK_SIZE)
+#define FANOUT_HANDSHAKE_CHECK 250
+
+FanOutSender::FanOutSender(QStringList *files, QString basePath, qint64 bufferBudget, QObject *parent)
+    : QObject(parent), mFiles(files), mBasePath(basePath), mBufferBudget(bufferBudget),
+      mPoolFirstChunk(0), mPoolBytes(0), mEndOfStream(false),
+      mFileCounter(0), mCurrentFile(nullptr), mHeaderSent(false), mEndQueued(false),
+      mShaper(nullptr), mFeedScheduled(false), mFinished(false)
+{
+    // The budget must hold at least one chunk per step, or nobody could move
+    if (mBufferBudget < FANOUT_CHUNK_SIZE) mBufferBudget = FANOUT_CHUNK_SIZE;
+    mStreamSize = computeStreamSize(false);
+    mStreamSizeV2 = computeStreamSize(true);
+
+    mClock.start();
+    mHandshakeTimer = new QTimer(this);
+    mHandshakeTimer->setInterval(FANOUT_HANDSHAKE_CHECK);
+    connect(mHandshakeTimer, SIGNAL(timeout()), this, SLOT(checkHandshakes()));
+}
+
+FanOutSender::~FanOutSender()
+{
+    foreach (Destination *d, mDestinations) {
+        if (d->socket) {
+            d->socket->disconnect(this);
+            if (!d->done) d->socket->abort();
+        }
+        delete d;
+    }
+    if (mCurrentFile) delete mCurrentFile;
+}
+
+// caps are the capabilities advertised by the buddy: with the v2
+// framing, the stream starts with the handshake
+void FanOutSender::addDestination(QString ip, qint16 port, quint32 caps, QString shaperKey)
+{
+    Destination *d = new Destination();
+    d->socket = nullptr;
+    d->ip = ip;
+    d->port = port;
+    d->shaperKey = shaperKey.isEmpty() ? ip : shaperKey;
+    d->v2 = false;
+    d->tryV2 = (caps & DuktoProtocol::CapFramingV2);
+    d->handshakeStarted = -1;
+    d->reconnectAt = -1;
+    d->nextChunk = 0;
+    d->writtenData = 0;
+    d->connected = false;
+    d->done = false;
+    mDestinations.append(d);
+}
+
+void FanOutSender::start()
+{
+    foreach (Destination *d, mDestinations)
+        connectDestination(d);
+    refreshStatus();
+}
+
+// The connection is started by start(), or again after a failed handshake
+void FanOutSender::connectDestination(Destination *d)
+{
+    if (d->socket) {
+        d->socket->disconnect(this);
+        d->socket->abort();
+        d->socket->deleteLater();
+    }
+    d->socket = new QTcpSocket(this);
+    d->connected = false;
+    d->writtenData = 0;
+    connect(d->socket, SIGNAL(connected()), this, SLOT(destinationConnected()));
+    connect(d->socket, SIGNAL(readyRead()), this, SLOT(destinationReadyRead()));
+    connect(d->socket, SIGNAL(bytesWritten(qint64)), this, SLOT(destinationBytesWritten(qint64)));
+    connect(d->socket, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(destinationSocketError(QAbstractSocket::SocketError)));
+    d->socket->connectToHost(d->ip, d->port);
+}
+
+void FanOutSender::abort()
+{
+    foreach (Destination *d, mDestinations) {
+        if (d->done) continue;
+        d->done = true;
+        if (!d->socket) continue;
+        d->socket->disconnect(this);
+        d->socket->abort();
+    }
+    mHandshakeTimer->stop();
+    mFinished = true;
+}
+
+FanOutSender::Destination* FanOutSender::destinationFor(QObject *socket)
+{
+    foreach (Destination *d, mDestinations)
+        if (d->socket == socket) return d;
+    return nullptr;
+}
+
+void FanOutSender::destinationConnected()
+{
+    Destination *d = destinationFor(sender());
+    if (!d) return;
+
+    // Agree on the framing before sending anything else
+    if (d->tryV2)
+    {
+        // The handshake is not part of the stream counted by writtenData
+        d->handshakeStarted = mClock.elapsed();
+        d->writtenData = -V2_HANDSHAKE_SIZE;
+        d->socket->write(handshake(DuktoProtocol::CapFramingV2));
+        mHandshakeTimer->start();
+        return;
+    }
+
+    d->connected = true;
+    feed(d);
+}
+
+// Reply of the receiver to the v2 handshake
+void FanOutSender::destinationReadyRead()
+{
+    Destination *d = destinationFor(sender());
+    if (!d || (d->handshakeStarted < 0)) return;
+    if (d->socket->bytesAvailable() < V2_HANDSHAKE_SIZE) return;
+
+    QByteArray hs = d->socket->read(V2_HANDSHAKE_SIZE);
+    d->handshakeStarted = -1;
+    if (!hs.startsWith(V2_MAGIC)) {
+        d->tryV2 = false;
+        d->reconnectAt = mClock.elapsed() + V2_FALLBACK_DELAY;
+        d->socket->disconnect(this);
+        d->socket->abort();
+        mHandshakeTimer->start();
+        return;
+    }
+
+    d->v2 = true;
+    d->connected = true;
+    feed(d);
+}
+
+// Buddies that don't answer the handshake are v1 clients: they are
+// connected again after a while and sent the v1 stream
+void FanOutSender::checkHandshakes()
+{
+    qint64 now = mClock.elapsed();
+    bool waiting = false;
+    foreach (Destination *d, mDestinations)
+    {
+        if (d->done) continue;
+        if ((d->handshakeStarted >= 0) && (now - d->handshakeStarted >= V2_HANDSHAKE_TIMEOUT))
+        {
+            d->handshakeStarted = -1;
+            d->tryV2 = false;
+            d->reconnectAt = now + V2_FALLBACK_DELAY;
+            d->socket->disconnect(this);
+            d->socket->abort();
+        }
+        if ((d->reconnectAt >= 0) && (now >= d->reconnectAt))
+        {
+            d->reconnectAt = -1;
+            connectDestination(d);
+        }
+        if ((d->handshakeStarted >= 0) || (d->reconnectAt >= 0)) waiting = true;
+    }
+    if (!waiting) mHandshakeTimer->stop();
+}
+
+void FanOutSender::destinationBytesWritten(qint64 b)
+{
+    Destination *d = destinationFor(sender());
+    if (!d || d->done) return;
+    d->writtenData += b;
+
+    feed(d);
+    refreshStatus();
+}
+
+void FanOutSender::destinationSocketError(QAbstractSocket::SocketError e)
+{
+    Destination *d = destinationFor(sender());
+    if (!d || d->done) return;
+
+    // The receiver closing the connection after the last byte is not an error
+    if ((e == QAbstractSocket::RemoteHostClosedError) && (d->writtenData == streamSize(d))) return;
+
+    // A v1 receiver can close the connection on the handshake, it's tried again with v1
+    if (d->handshakeStarted >= 0)
+    {
+        d->handshakeStarted = -1;
+        d->tryV2 = false;
+        d->reconnectAt = mClock.elapsed() + V2_FALLBACK_DELAY;
+        d->socket->disconnect(this);
+        d->socket->abort();
+        mHandshakeTimer->start();
+        return;
+    }
+
+    // Drop the destination, the others go on without it
+    d->done = true;
+    d->connected = false;
+    d->socket->disconnect(this);
+    d->socket->abort();
+    emit destinationFailed(d->ip, e);
+
+    // It could have been the slowest one, holding back the others
+    trimPool();
+    refreshStatus();
+    checkFinished();
+}
+
+// Writes to the socket all the chunks it can take without
+// growing its kernel/Qt write buffer over the low water mark
+void FanOutSender::feed(Destination *d)
+{
+    if (!d->connected || d->done) return;
+
+    while (d->socket->bytesToWrite() < FANOUT_SOCKET_LOW_WATER)
+    {
+        qint64 idx = d->nextChunk - mPoolFirstChunk;
+
+        // This destination is ahead of everyone: a new chunk is needed
+        if (idx == mPool.size())
+        {
+            if (!mEndOfStream && (mPoolBytes >= mBufferBudget)) return;
+            if (!mEndOfStream && !produce()) mEndOfStream = true;
+
+            // Everything written? Then this destination is complete
+            if (mEndOfStream) {
+                if (d->socket->bytesToWrite() == 0) {
+                    d->done = true;
+                    d->socket->disconnectFromHost();
+                    checkFinished();
+                }
+                return;
+            }
+        }
+
+        const Chunk &c = mPool.at(idx);
+        const QByteArray &head = d->v2 ? c.v2Head : c.v1Head;
+        qint64 size = head.size() + c.data.size() + ((d->v2 && !c.data.isEmpty()) ? V2_FRAME_HEADER_SIZE : 0);
+
+        // Rate limiting: a whole chunk goes out as soon as there are
+        // tokens, the bucket debt spaces out the following ones
+        if (mShaper)
+        {
+            if (mShaper->allowance(d->shaperKey, 1) == 0)
+            {
+                if (!mFeedScheduled) {
+                    mFeedScheduled = true;
+                    QTimer::singleShot(mShaper->msUntilAvailable(d->shaperKey), this, SLOT(feedAll()));
+                }
+                return;
+            }
+            mShaper->consume(d->shaperKey, size);
+        }
+
+        d->nextChunk++;
+        if (size == 0) continue;
+        if (!head.isEmpty()) d->socket->write(head);
+        if (!c.data.isEmpty())
+        {
+            if (d->v2) d->socket->write(frameHeader(FRAME_DATA, c.data.size()));
+            d->socket->write(c.data);
+        }
+    }
+}
+
+void FanOutSender::feedAll()
+{
+    mFeedScheduled = false;
+    if (mFinished) return;
+    foreach (Destination *d, mDestinations)
+        feed(d);
+}
+
+// Reads the next piece of the outgoing stream into the pool
+bool FanOutSender::produce()
+{
+    Chunk c;
+
+    // Global header
+    //  - N. elements
+    //  - Total size
+    if (!mHeaderSent)
+    {
+        qint64 count = mFiles->count();
+        qint64 total = 0;
+        for (int i = 0; i < mFiles->count(); i++)
+        {
+            QFileInfo fi(mFiles->at(i));
+            if (!fi.isDir()) total += fi.size();
+        }
+        c.v1Head.append((char*) &count, sizeof(count));
+        c.v1Head.append((char*) &total, sizeof(total));
+        QByteArray payload;
+        appendInt64(payload, count);
+        appendInt64(payload, total);
+        c.v2Head = frame(FRAME_SESSION, payload);
+        mHeaderSent = true;
+    }
+
+    // Current file data
+    else if (mCurrentFile)
+    {
+        c.data = mCurrentFile->read(FANOUT_CHUNK_SIZE);
+        if (c.data.size() == 0) {
+            mCurrentFile->close();
+            delete mCurrentFile;
+            mCurrentFile = nullptr;
+        }
+    }
+
+    // Next element headers, batched together until a file with data is opened.
+    // The first data of a file is a whole chunk, like the following ones,
+    // so that the number of v2 data frames is known in advance.
+    while (c.data.isEmpty() && !mCurrentFile && (mFileCounter < mFiles->size()) && (c.v1Head.size() < FANOUT_CHUNK_SIZE))
+    {
+        QString fullname = mFiles->at(mFileCounter++);
+        qint64 size = -1;
+        QFileInfo fi(fullname);
+        if (fi.isFile()) size = fi.size();
+        c.v1Head.append(elementHeader(fullname, size, false));
+        c.v2Head.append(elementHeader(fullname, size, true));
+
+        if (size > -1) {
+            mCurrentFile = new QFile(fullname);
+            mCurrentFile->open(QIODevice::ReadOnly);
+            c.data = mCurrentFile->read(FANOUT_CHUNK_SIZE);
+        }
+    }
+
+    // End of the stream, only the v2 framing marks it
+    if (c.v1Head.isEmpty() && c.v2Head.isEmpty() && c.data.isEmpty())
+    {
+        if (mEndQueued) return false;
+        c.v2Head = frame(FRAME_END, QByteArray());
+        mEndQueued = true;
+    }
+
+    mPool.append(c);
+    mPoolBytes += c.v1Head.size() + c.v2Head.size() + c.data.size();
+    return true;
+}
+
+// Header of an element, as built by DuktoProtocol::elementHeader()
+QByteArray FanOutSender::elementHeader(const QString &fullname, qint64 size, bool v2)
+{
+    QByteArray header;
+    QString name = fullname;
+    name.replace(mBasePath + "/", "");
+    if (v2)
+    {
+        appendInt64(header, size);
+        header.append(name.toUtf8());
+        return frame(FRAME_ELEMENT, header);
+    }
+    header.append(name.toUtf8() + '\0');
+    header.append((char*) &size, sizeof(size));
+    return header;
+}
+
+// Size of the whole stream, headers included
+qint64 FanOutSender::computeStreamSize(bool v2)
+{
+    qint64 size = v2 ? (2 * V2_FRAME_HEADER_SIZE + 2 * sizeof(qint64)) : 2 * sizeof(qint64);
+    for (int i = 0; i < mFiles->count(); i++)
+    {
+        QFileInfo fi(mFiles->at(i));
+        qint64 s = fi.isFile() ? fi.size() : -1;
+        size += elementHeader(mFiles->at(i), s, v2).size();
+        if (s > 0) size += s;
+        if (v2 && (s > 0)) size += ((s + FANOUT_CHUNK_SIZE - 1) / FANOUT_CHUNK_SIZE) * V2_FRAME_HEADER_SIZE;
+    }
+    return size;
+}
+
+// Releases the chunks already written by every destination still alive,
+// then wakes up the destinations that were waiting for pool space
+void FanOutSender::trimPool()
+{
+    qint64 minChunk = mPoolFirstChunk + mPool.size();
+    foreach (Destination *d, mDestinations)
+        if (!d->done && d->nextChunk < minChunk)
+            minChunk = d->nextChunk;
+
+    bool freed = false;
+    while (mPoolFirstChunk < minChunk)
+    {
+        const Chunk &c = mPool.first();
+        mPoolBytes -= c.v1Head.size() + c.v2Head.size() + c.data.size();
+        mPool.removeFirst();
+        mPoolFirstChunk++;
+        freed = true;
+    }
+
+    if (!freed) return;
+    foreach (Destination *d, mDestinations)
+        feed(d);
+}
+
+// Progress is the one of the slowest destination still alive,
+// in v1 stream bytes whatever the framing of each destination
+void FanOutSender::refreshStatus()
+{
+    qint64 partial = -1;
+    foreach (Destination *d, mDestinations)
+    {
+        if (d->done) continue;
+        qint64 written = qMax(d->writtenData, (qint64) 0);
+        if (d->v2) written = (qint64) (written * (double) mStreamSize / mStreamSizeV2);
+        if ((partial == -1) || (written < partial))
+            partial = written;
+    }
+    if (partial == -1) partial = mStreamSize;
+
+    trimPool();
+    emit transferStatusUpdate(mStreamSize, partial);
+}
+
+void FanOutSender::checkFinished()
+{
+    if (mFinished) return;
+
+    int succeeded = 0;
+    foreach (Destination *d, mDestinations) {
+        if (!d->done) return;
+        if (d->writtenData == streamSize(d)) succeeded++;
+    }
+
+    mFinished = true;
+    mHandshakeTimer->stop();
+    if (mCurrentFile) {
+        mCurrentFile->close();
+        delete mCurrentFile;
+        mCurrentFile = nullptr;
+    }
+    emit finished(succeeded);
+}
@@ -0,0 +1,130 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2011 Emanuele Colombo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef FANOUTSENDER_H
+#define FANOUTSENDER_H
+
+#include <QObject>
+#include <QList>
+#include <QStringList>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QtNetwork/QTcpSocket>
+
+class QFile;
+class QTimer;
+class BandwidthShaper;
+
+// Sends the same set of files to several buddies at once.
+// The outgoing stream is identical for every destination, so it is
+// read from disk only once into a shared pool of chunks; each socket
+// consumes the pool at its own pace and a chunk is released as soon as
+// the slowest destination has written it. The pool never grows beyond
+// the buffer budget: when it is full, faster destinations wait for the
+// slowest one to catch up.
+// Every destination negotiates its own framing: the headers of a chunk
+// are kept both in the v1 and in the v2 encoding, the file data is
+// shared and framed while it's written.
+class FanOutSender : public QObject
+{
+    Q_OBJECT
+
+public:
+    FanOutSender(QStringList *files, QString basePath, qint64 bufferBudget, QObject *parent = nullptr);
+    virtual ~FanOutSender();
+    void addDestination(QString ip, qint16 port, quint32 caps = 0, QString shaperKey = QString());
+    void start();
+    void abort();
+    inline qint64 totalSize() { return mStreamSize; }
+    inline void setShaper(BandwidthShaper *shaper) { mShaper = shaper; }
+
+signals:
+    void transferStatusUpdate(qint64 total, qint64 partial);
+    void destinationFailed(QString ip, int code);
+    void finished(int succeeded);
+
+private slots:
+    void destinationConnected();
+    void destinationReadyRead();
+    void destinationBytesWritten(qint64 b);
+    void destinationSocketError(QAbstractSocket::SocketError e);
+    void checkHandshakes();
+    void feedAll();
+
+private:
+    struct Chunk {
+        QByteArray v1Head;          // Session and element headers, v1 encoding
+        QByteArray v2Head;          // The same headers as v2 frames
+        QByteArray data;            // File data following the headers
+    };
+
+    struct Destination {
+        QTcpSocket *socket;
+        QString ip;
+        qint16 port;
+        QString shaperKey;          // Per-buddy rate limit to apply
+        bool v2;                    // Stream sent with the v2 framing
+        bool tryV2;                 // The buddy advertised the v2 framing
+        qint64 handshakeStarted;    // mClock time of the handshake, -1 if not waiting
+        qint64 reconnectAt;         // mClock time of the v1 reconnection, -1 if none
+        qint64 nextChunk;           // Sequence number of the next chunk to write
+        qint64 writtenData;         // Bytes confirmed as written to the socket
+        bool connected;
+        bool done;
+    };
+
+    Destination* destinationFor(QObject *socket);
+    void connectDestination(Destination *d);
+    QByteArray elementHeader(const QString &fullname, qint64 size, bool v2);
+    qint64 computeStreamSize(bool v2);
+    inline qint64 streamSize(Destination *d) { return d->v2 ? mStreamSizeV2 : mStreamSize; }
+    bool produce();
+    void feed(Destination *d);
+    void trimPool();
+    void refreshStatus();
+    void checkFinished();
+
+    QStringList *mFiles;            // Elements to send (already expanded)
+    QString mBasePath;              // Base path stripped from element names
+    qint64 mBufferBudget;           // Max bytes kept in the shared pool
+    qint64 mStreamSize;             // Total bytes of the outgoing v1 stream
+    qint64 mStreamSizeV2;           // Total bytes of the outgoing v2 stream
+
+    QList<Destination*> mDestinations;
+    QElapsedTimer mClock;
+    QTimer *mHandshakeTimer;        // Fallback to v1 for the buddies that don't answer
+
+    // Shared pool
+    QList<Chunk> mPool;             // Chunks not yet written by every destination
+    qint64 mPoolFirstChunk;         // Sequence number of mPool.first()
+    qint64 mPoolBytes;              // Bytes currently held in the pool
+    bool mEndOfStream;              // The whole stream has been produced
+
+    // Producer
+    int mFileCounter;
+    QFile *mCurrentFile;
+    bool mHeaderSent;
+    bool mEndQueued;                // The v2 end frame is in the pool
+
+    BandwidthShaper *mShaper;       // Rate limits, if any
+    bool mFeedScheduled;            // Waiting for the rate limiter
+
+    bool mFinished;
+};
+
+#endif // FANOUTSENDER_H
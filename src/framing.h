@@ -0,0 +1,84 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2011 Emanuele Colombo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef FRAMING_H
+#define FRAMING_H
+
+#include <QByteArray>
+#include <QtEndian>
+
+// v2 framing
+//  - Handshake: magic, version (u8), capabilities (u32), sent by both ends
+//  - Frames: type (u8), payload length (u32), payload
+// All the integers are big endian.
+#define V2_MAGIC "DKTOv2\r\n"
+#define V2_MAGIC_SIZE 8
+#define V2_VERSION 2
+#define V2_HANDSHAKE_SIZE (V2_MAGIC_SIZE + 1 + 4)
+#define V2_FRAME_HEADER_SIZE 5
+#define V2_MAX_CONTROL_FRAME 65536
+#define V2_CHUNK_SIZE 65536
+#define V2_HANDSHAKE_TIMEOUT 2000
+#define V2_FALLBACK_DELAY 1000
+
+#define FRAME_SESSION   0x01    // N. elements (i64), total size (i64)
+#define FRAME_ELEMENT   0x02    // Size (i64, -1 for a folder), UTF-8 name
+#define FRAME_DATA      0x03    // Data of the current element
+#define FRAME_END       0x04    // End of the stream
+#define FRAME_ABORT     0x05    // Transfer aborted by the sender
+#define FRAME_HOLE      0x06    // Length (i64) of a hole in the current file (CapSparse)
+
+static inline void appendInt64(QByteArray &a, qint64 v)
+{
+    uchar b[8];
+    qToBigEndian<qint64>(v, b);
+    a.append((char*) b, sizeof(b));
+}
+
+static inline qint64 readInt64(const char *p)
+{
+    return qFromBigEndian<qint64>((const uchar*) p);
+}
+
+// Header of a frame, for payloads written separately
+static inline QByteArray frameHeader(quint8 type, quint32 length)
+{
+    uchar h[V2_FRAME_HEADER_SIZE];
+    h[0] = type;
+    qToBigEndian<quint32>(length, h + 1);
+    return QByteArray((char*) h, V2_FRAME_HEADER_SIZE);
+}
+
+static inline QByteArray frame(quint8 type, const QByteArray &payload)
+{
+    QByteArray f = frameHeader(type, payload.size());
+    f.append(payload);
+    return f;
+}
+
+static inline QByteArray handshake(quint32 caps)
+{
+    uchar c[4];
+    qToBigEndian<quint32>(caps, c);
+    QByteArray h(V2_MAGIC, V2_MAGIC_SIZE);
+    h.append((char) V2_VERSION);
+    h.append((char*) c, sizeof(c));
+    return h;
+}
+
+#endif // FRAMING_H
@@ -23,10 +23,15 @@
 
 #include "platform.h"
 #include "updateschecker.h"
+#include "avatarcache.h"
+#include "screenshare.h"
+#include "startupprofiler.h"
+#include "tracer.h"
 
 #include <QHash>
 #include <QGuiApplication>
 #include <QQmlContext>
+#include <QQuickWindow>
 
 #include <QTimer>
 #include <QDesktopServices>
@@ -34,7 +39,8 @@
 #include <QClipboard>
 #include <QRegExp>
 #include <QThread>
-#include <QTemporaryFile>
+#include <QBuffer>
+#include <QtConcurrent/QtConcurrentRun>
 #include <QFileDialog>
 #include <QtGui>
 #if defined(Q_WS_S60)
@@ -52,11 +58,15 @@
 #endif
 
 #define NETWORK_PORT 4644 // 6742
+// Periodic hellos of the buddies without heartbeats
+#define HELLO_INTERVAL 60000
+#define ACTIVATION_HELLO_MIN_INTERVAL 30000
 
 GuiBehind::GuiBehind(QQmlApplicationEngine *engine) :
-	QObject(nullptr), mShowBackTimer(nullptr), mPeriodicHelloTimer(nullptr),
+	QObject(nullptr), mShowBackTimer(nullptr),
 	mClipboard(nullptr), mMiniWebServer(nullptr), mSettings(nullptr), mDestBuddy(nullptr),
-	mUpdatesChecker(nullptr)
+	mUpdatesChecker(nullptr), mScreenShare(nullptr), mScreenShareReceiver(nullptr), mScreenShareFrame(0),
+	mStarted(false)
 {    
     // Status variables
     //mView->setGuiBehindReference(this);
@@ -77,9 +87,14 @@ GuiBehind::GuiBehind(QQmlApplicationEngine *engine) :
 
     // Settings
     mSettings = new Settings(this);
+    StartupProfiler::mark("settings");
 
-    // Mini web server
-    mMiniWebServer = new MiniWebServer(NETWORK_PORT + 1);
+    // Screen sharing, on the port after the web server
+    mScreenShare = new ScreenShareSender(this);
+    mScreenShare->setInterval(mSettings->screenShareInterval());
+    mScreenShare->setShaper(mDuktoProtocol.shaper());
+    mScreenShareReceiver = new ScreenShareReceiver();
+    mScreenShareReceiver->setBuddies(&mBuddiesList);
 
     // Destination buddy
     mDestBuddy = new DestinationBuddy(this);
@@ -92,40 +107,62 @@ GuiBehind::GuiBehind(QQmlApplicationEngine *engine) :
 
     // Init buddy list
 
+    engine->addImageProvider("avatar", new AvatarCache());
+    engine->addImageProvider("screenshare", mScreenShareReceiver);
     engine->rootContext()->setContextProperty("buddiesListData", &mBuddiesList);
     engine->rootContext()->setContextProperty("recentListData", &mRecentList);
     engine->rootContext()->setContextProperty("ipAddressesData", &mIpAddresses);
     engine->rootContext()->setContextProperty("guiBehind", this);
     engine->rootContext()->setContextProperty("destinationBuddy", mDestBuddy);
     engine->rootContext()->setContextProperty("theme", &mTheme);
+    StartupProfiler::mark("models");
 
     // Register protocol signals
     connect(&mDuktoProtocol, SIGNAL(peerListAdded(Peer)), this, SLOT(peerListAdded(Peer)));
     connect(&mDuktoProtocol, SIGNAL(peerListRemoved(Peer)), this, SLOT(peerListRemoved(Peer)));
     connect(&mDuktoProtocol, SIGNAL(receiveFileStart(QString)), this, SLOT(receiveFileStart(QString)));
-    connect(&mDuktoProtocol, SIGNAL(transferStatusUpdate(qint64,qint64)), this, SLOT(transferStatusUpdate(qint64,qint64)));
+    connect(&mDuktoProtocol, SIGNAL(transferStatusUpdate(qint64,qint64,qint64,int)), this, SLOT(transferStatusUpdate(qint64,qint64,qint64,int)));
     connect(&mDuktoProtocol, SIGNAL(receiveFileComplete(QStringList*,qint64)), this, SLOT(receiveFileComplete(QStringList*,qint64)));
     connect(&mDuktoProtocol, SIGNAL(receiveTextComplete(QString*,qint64)), this, SLOT(receiveTextComplete(QString*,qint64)));
     connect(&mDuktoProtocol, SIGNAL(sendFileComplete(QStringList*)), this, SLOT(sendFileComplete(QStringList*)));
     connect(&mDuktoProtocol, SIGNAL(sendFileError(int)), this, SLOT(sendFileError(int)));
     connect(&mDuktoProtocol, SIGNAL(receiveFileCancelled()), this, SLOT(receiveFileCancelled()));
     connect(&mDuktoProtocol, SIGNAL(sendFileAborted()), this, SLOT(sendFileAborted()));
+    connect(&mDuktoProtocol, SIGNAL(fanOutDestinationFailed(QString,int)), this, SLOT(fanOutDestinationFailed(QString,int)));
 
     // Register other signals
     connect(this, SIGNAL(remoteDestinationAddressChanged()), this, SLOT(remoteDestinationAddressHandler()));
+    connect(&mScreenEncoder, SIGNAL(finished()), this, SLOT(sendScreenStage3()));
+    connect(mScreenShare, SIGNAL(stopped(int)), this, SLOT(screenShareStopped(int)));
+    connect(mScreenShareReceiver, SIGNAL(sharingStarted(QString)), this, SLOT(screenShareStarted(QString)));
+    connect(mScreenShareReceiver, SIGNAL(frameUpdated()), this, SLOT(screenShareFrameUpdated()));
+    connect(mScreenShareReceiver, SIGNAL(sharingStopped()), this, SLOT(screenShareEnded()));
 
-    // Say "hello"
+    // Protocol settings
     mDuktoProtocol.setPorts(NETWORK_PORT, NETWORK_PORT);
-    mDuktoProtocol.initialize();
-    mDuktoProtocol.sayHello(QHostAddress::Broadcast);
-
-    // Periodic "hello" timer
-    mPeriodicHelloTimer = new QTimer(this);
-    connect(mPeriodicHelloTimer, SIGNAL(timeout()), this, SLOT(periodicHello()));
-    mPeriodicHelloTimer->start(60000);
+    mDuktoProtocol.setFanOutBufferBudget(mSettings->fanOutBufferBudget());
+    mDuktoProtocol.setPeerExpiry(HELLO_INTERVAL, mSettings->peerExpiryHeartbeats());
+    mDuktoProtocol.setLegacyBroadcast(mSettings->legacyBroadcast());
+    mDuktoProtocol.setTelemetryLog(mSettings->telemetryLogPath());
+    mDuktoProtocol.setInstanceId(mSettings->instanceId());
+
+    // Bandwidth limits
+    mDuktoProtocol.shaper()->setGlobalLimit(mSettings->bandwidthLimit() * 1024);
+    foreach (const QString &entry, mSettings->peerBandwidthLimits())
+        mDuktoProtocol.shaper()->setPeerLimit(entry.section('=', 0, 0), entry.section('=', 1, 1).toLongLong() * 1024);
+    mDuktoProtocol.shaper()->setSchedule(mSettings->bandwidthSchedule());
+    StartupProfiler::mark("protocol setup");
 
     // Load GUI
     engine->load(QUrl("qrc:/qml/dukto/Dukto.qml"));
+    StartupProfiler::mark("qml loaded");
+
+    // Whatever isn't needed to draw the window waits for its first frame
+    QQuickWindow *window = engine->rootObjects().isEmpty() ? nullptr : qobject_cast<QQuickWindow*>(engine->rootObjects().first());
+    if (window)
+        connect(window, SIGNAL(frameSwapped()), this, SLOT(firstFrameSwapped()), Qt::QueuedConnection);
+    else
+        QTimer::singleShot(0, this, SLOT(firstFrameSwapped()));
 
 //#ifndef Q_WS_S60
 //    view->restoreGeometry(mSettings->windowGeometry());
@@ -146,15 +183,56 @@ GuiBehind::GuiBehind(QQmlApplicationEngine *engine) :
 
 GuiBehind::~GuiBehind()
 {
-    mDuktoProtocol.sayGoodbye();
+    // Closed before the discovery even started
+    if (mStarted) {
+        mSettings->savePeerCache(mDuktoProtocol.exportPeerCache());
+        mDuktoProtocol.sayGoodbye();
+    }
 
     if (mUpdatesChecker) mUpdatesChecker->deleteLater();
     if (mMiniWebServer) mMiniWebServer->deleteLater();
     if (mShowBackTimer) mShowBackTimer->deleteLater();
-    if (mPeriodicHelloTimer) mPeriodicHelloTimer->deleteLater();
     if (mDestBuddy) mDestBuddy->deleteLater();
 }
 
+void GuiBehind::firstFrameSwapped()
+{
+    if (sender()) sender()->disconnect(this, SLOT(firstFrameSwapped()));
+    if (mStarted) return;
+    StartupProfiler::mark("first frame");
+
+    // Let the event loop breathe before the deferred work
+    QTimer::singleShot(0, this, SLOT(deferredInit()));
+}
+
+// Startup work moved after the first frame: the avatar (looked up on
+// disk and scaled for the web server), the history log, the listeners
+// and the network discovery
+void GuiBehind::deferredInit()
+{
+    if (mStarted) return;
+    mStarted = true;
+
+    // Mini web server
+    mMiniWebServer = new MiniWebServer(NETWORK_PORT + 1);
+
+    // Transfer history
+    mRecentList.load();
+
+    // Say "hello"
+    mDuktoProtocol.initialize();
+    mDuktoProtocol.importPeerCache(mSettings->peerCache());
+    mDuktoProtocol.sayHello(QHostAddress::Broadcast);
+
+    // Screen sharing, on the LAN only along with the discovery
+    mScreenShareReceiver->listen(mDuktoProtocol.isDiscovering() ? QHostAddress::Any : QHostAddress::LocalHost,
+                                 NETWORK_PORT + 2);
+    StartupProfiler::mark("deferred init");
+
+    StartupProfiler::report();
+    if (StartupProfiler::isBenchmark()) QGuiApplication::quit();
+}
+
 // Add the new buddy to the buddy list
 void GuiBehind::peerListAdded(Peer peer) {
     mBuddiesList.addBuddy(peer);
@@ -209,18 +287,30 @@ void GuiBehind::receiveFileStart(QString senderIp)
     emit transferStart();
 }
 
-void GuiBehind::transferStatusUpdate(qint64 total, qint64 partial)
+void GuiBehind::transferStatusUpdate(qint64 total, qint64 partial, qint64 bytesPerSecond, int secondsLeft)
 {
+    TraceSpan span("ui", "progress update");
     // Stats formatting
+    QString stats;
     if (total < 1024)
-        setCurrentTransferStats(QString::number(partial) + " B of " + QString::number(total) + " B");
+        stats = QString::number(partial) + " B of " + QString::number(total) + " B";
     else if (total < 1048576)
-        setCurrentTransferStats(QString::number(partial * 1.0 / 1024, 'f', 1) + " KB of " + QString::number(total * 1.0 / 1024, 'f', 1) + " KB");
+        stats = QString::number(partial * 1.0 / 1024, 'f', 1) + " KB of " + QString::number(total * 1.0 / 1024, 'f', 1) + " KB";
     else
-        setCurrentTransferStats(QString::number(partial * 1.0 / 1048576, 'f', 1) + " MB of " + QString::number(total * 1.0 / 1048576, 'f', 1) + " MB");
+        stats = QString::number(partial * 1.0 / 1048576, 'f', 1) + " MB of " + QString::number(total * 1.0 / 1048576, 'f', 1) + " MB";
+
+    // Throughput and time left, once they're known
+    if ((bytesPerSecond > 0) && (partial < total))
+    {
+        stats += " - " + QString::number(bytesPerSecond * 1.0 / 1048576, 'f', 1) + " MB/s";
+        if (secondsLeft >= 0)
+            stats += ", " + QString::number(secondsLeft / 60) + ":" + QString::number(secondsLeft % 60).rightJustified(2, '0') + " left";
+    }
+    setCurrentTransferStats(stats);
 
     double percent = partial * 1.0 / total * 100;
     setCurrentTransferProgress(percent);
+    Tracer::counter("progress", "percent", (total > 0) ? partial * 100 / total : 0);
 
 
 }
@@ -309,9 +399,22 @@ void GuiBehind::showSendPage(QString ip)
     // Update exposed data for the selected user
     mDestBuddy->fillFromItem(buddy);
 
+    // Clicking one of the buddies picked with Ctrl+click sends to all of them,
+    // any other click forgets the selection
+    QStringList selected = mBuddiesList.selectedIps();
+    if ((selected.count() > 1) && selected.contains(ip))
+        mSendToBuddies = selected;
+    else {
+        mSendToBuddies.clear();
+        mBuddiesList.clearSelection();
+    }
+    emit selectedBuddiesChanged();
+
     // Preventive update of destination buddy
     if (mDestBuddy->ip() == "IP")
         setCurrentTransferBuddy(remoteDestinationAddress());
+    else if (mSendToBuddies.count() > 1)
+        setCurrentTransferBuddy(QString::number(mSendToBuddies.count()) + " buddies");
     else
         setCurrentTransferBuddy(mDestBuddy->username());
 
@@ -350,6 +453,80 @@ void GuiBehind::sendFiles(QStringList files)
 	startTransfer(files);
 }
 
+void GuiBehind::toggleBuddySelection(QString ip)
+{
+    mBuddiesList.toggleSelected(ip);
+}
+
+int GuiBehind::selectedBuddies()
+{
+    return mSendToBuddies.count();
+}
+
+// Sends the same files to several buddies at once
+void GuiBehind::sendFilesToBuddies(QStringList ips, QStringList files)
+{
+    if ((ips.count() == 0) || (files.count() == 0)) return;
+
+    // Look for the buddies ports
+    QList<QPair<QString, qint16> > dests;
+    foreach (const QString &ip, ips) {
+        QStandardItem *buddy = mBuddiesList.buddyByIp(ip);
+        if (buddy == nullptr) continue;
+        dests.append(qMakePair(ip, (qint16) buddy->data(BuddyListItemModel::Port).toInt()));
+    }
+    if (dests.count() == 0) return;
+
+    // Update GUI for file transfer
+    mFanOutFailures.clear();
+    setCurrentTransferBuddy(QString::number(dests.count()) + " buddies");
+    setCurrentTransferSending(true);
+    setCurrentTransferStats("Connecting...");
+    setCurrentTransferProgress(0);
+    emit transferStart();
+
+    mDuktoProtocol.sendFileToMany(dests, files);
+}
+
+// Changes the rate limit for a single buddy, also for a running transfer.
+// It's saved by instance ID when the buddy has one, replacing a limit
+// set on its address before.
+void GuiBehind::setBuddyBandwidthLimit(QString ip, int kbps)
+{
+    QString key = mDuktoProtocol.peerKey(ip);
+    QStringList limits = mSettings->peerBandwidthLimits();
+    for (int i = limits.count() - 1; i >= 0; i--)
+    {
+        QString entryKey = limits.at(i).section('=', 0, 0);
+        if ((entryKey == key) || (entryKey == ip))
+            limits.removeAt(i);
+    }
+    if (kbps > 0)
+        limits.append(key + "=" + QString::number(kbps));
+    mSettings->savePeerBandwidthLimits(limits);
+
+    if (key != ip) mDuktoProtocol.shaper()->setPeerLimit(ip, 0);
+    mDuktoProtocol.shaper()->setPeerLimit(key, kbps * 1024);
+}
+
+// Rate limit of a buddy in KB/s, 0 if there's none
+int GuiBehind::buddyBandwidthLimit(QString ip)
+{
+    QString key = mDuktoProtocol.peerKey(ip);
+    foreach (const QString &entry, mSettings->peerBandwidthLimits())
+        if (entry.section('=', 0, 0) == key)
+            return entry.section('=', 1, 1).toInt();
+    return 0;
+}
+
+// One of the destinations of a one-to-many send has been dropped
+void GuiBehind::fanOutDestinationFailed(QString ip, int code)
+{
+    Q_UNUSED(code);
+    QString name = mBuddiesList.buddyNameByIp(ip);
+    mFanOutFailures.append(name == "" ? ip : name);
+}
+
 void GuiBehind::sendSomeFiles()
 {
     // Show file selection dialog
@@ -417,18 +594,32 @@ void GuiBehind::sendScreenStage2() {
     // Screenshot
     QScreen *screenid = QGuiApplication::primaryScreen();
 
-    QPixmap screen =  screenid->grabWindow(0);
+    QImage screen =  screenid->grabWindow(0).toImage();
 
     // Restore window
 
 
-    // Salvataggio screenshot in file
-    QTemporaryFile tempFile;
-    tempFile.setAutoRemove(false);
-    tempFile.open();
-    mScreenTempPath = tempFile.fileName();
-    tempFile.close();
-    screen.save(mScreenTempPath, "JPG", 95);
+    // The encoding takes a while on large screens, it's done
+    // on a worker thread straight into memory
+    if (mScreenEncoder.isRunning()) return;
+    mScreenEncoder.setFuture(QtConcurrent::run(encodeScreenshot, screen,
+                                               mSettings->screenshotFormat(), mSettings->screenshotQuality()));
+}
+
+// Runs on a worker thread, QImage (unlike QPixmap) can be used there
+QByteArray GuiBehind::encodeScreenshot(QImage screen, QString format, int quality)
+{
+    QByteArray data;
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::WriteOnly);
+    screen.save(&buffer, format.toLatin1().constData(), quality);
+    return data;
+}
+
+void GuiBehind::sendScreenStage3()
+{
+    QByteArray data = mScreenEncoder.result();
+    if (data.isEmpty()) return;
 
     // Prepare file transfer
     QString ip;
@@ -436,11 +627,72 @@ void GuiBehind::sendScreenStage2() {
     if (!prepareStartTransfer(&ip, &port)) return;
 
     // Start screen transfer
-    mDuktoProtocol.sendScreen(ip, port, mScreenTempPath);
+    mDuktoProtocol.sendScreen(ip, port, data, mSettings->screenshotFormat());
+}
+
+// Starts or stops sharing the screen with the selected buddy
+void GuiBehind::toggleScreenShare()
+{
+    if (mScreenShare->isActive()) {
+        mScreenShare->stop();
+        emit screenSharingChanged();
+        return;
+    }
+
+    QString ip;
+    qint16 port;
+    if (!resolveDestination(&ip, &port)) return;
+    if (port == 0) port = NETWORK_PORT;
+    mScreenShare->start(ip, port + 2);
+    emit screenSharingChanged();
+}
+
+void GuiBehind::screenShareStopped(int code)
+{
+    emit screenSharingChanged();
+
+    // Closed by the buddy
+    if (code == QAbstractSocket::RemoteHostClosedError) return;
+
+    setMessagePageTitle("Error");
+    setMessagePageText("Sorry, your screen can't be shared with your buddy...\n\nError code: " + QString::number(code));
+    setMessagePageBackState("send");
+    emit gotoMessagePage();
+}
+
+void GuiBehind::screenShareStarted(QString senderIp)
+{
+    QString sender = mBuddiesList.buddyNameByIp(senderIp);
+    mScreenShareBuddy = (sender == "") ? "remote sender" : sender;
+    emit screenShareBuddyChanged();
+    emit gotoScreenSharePage();
+}
+
+void GuiBehind::screenShareFrameUpdated()
+{
+    mScreenShareFrame++;
+    emit screenShareFrameChanged();
+}
+
+void GuiBehind::screenShareEnded()
+{
+    if (overlayState() == "screenshare") emit hideAllOverlays();
+}
+
+// The user left the page of a screen sharing
+void GuiBehind::closeScreenShare()
+{
+    mScreenShareReceiver->close();
 }
 
 void GuiBehind::startTransfer(QStringList files)
 {
+    // Buddies picked together in the buddy list
+    if (mSendToBuddies.count() > 1) {
+        sendFilesToBuddies(mSendToBuddies, files);
+        return;
+    }
+
     // Prepare file transfer
     QString ip;
     qint16 port;
@@ -462,6 +714,20 @@ void GuiBehind::startTransfer(QString text)
 }
 
 bool GuiBehind::prepareStartTransfer(QString *ip, qint16 *port)
+{
+    if (!resolveDestination(ip, port)) return false;
+
+    // Update GUI for file transfer
+    setCurrentTransferSending(true);
+    setCurrentTransferStats("Connecting...");
+    setCurrentTransferProgress(0);
+
+    emit transferStart();
+    return true;
+}
+
+// Address of the selected buddy, or of the remote destination
+bool GuiBehind::resolveDestination(QString *ip, qint16 *port)
 {
     // Check if it's a remote file transfer
     if (mDestBuddy->ip() == "IP") {
@@ -469,11 +735,18 @@ bool GuiBehind::prepareStartTransfer(QString *ip, qint16 *port)
         // Remote transfer
         QString dest = remoteDestinationAddress();
 
+        // IPv6 address without port
+        if ((dest.count(':') > 1) && !dest.startsWith("[")) {
+            *ip = dest;
+            *port = 0;
+        }
+
         // Check if port is specified
-        if (dest.contains(":")) {
+        // (IPv6 addresses with a port are written as [address]:port)
+        else if (dest.contains(":") || dest.startsWith("[")) {
 
             // Port is specified or destination is malformed...
-            QRegExp rx("^(.*):([0-9]+)$");
+            QRegExp rx("^\\[([^\\]]+)\\](?::([0-9]+))?$|^([^:]+):([0-9]+)$");
             if (rx.indexIn(dest) == -1) {
 
                 // Malformed destination
@@ -486,8 +759,8 @@ bool GuiBehind::prepareStartTransfer(QString *ip, qint16 *port)
 
             // Get IP (or hostname) and port
              QStringList capt = rx.capturedTexts();
-             *ip = capt[1];
-             *port = capt[2].toInt();
+             *ip = capt[1].isEmpty() ? capt[3] : capt[1];
+             *port = capt[1].isEmpty() ? capt[4].toInt() : capt[2].toInt();
         }
         else {
 
@@ -504,13 +777,6 @@ bool GuiBehind::prepareStartTransfer(QString *ip, qint16 *port)
         *port = mDestBuddy->port();
         setCurrentTransferBuddy(mDestBuddy->username());
     }
-
-    // Update GUI for file transfer
-    setCurrentTransferSending(true);
-    setCurrentTransferStats("Connecting...");
-    setCurrentTransferProgress(0);
-
-    emit transferStart();
     return true;
 }
 
@@ -526,17 +792,13 @@ void GuiBehind::sendFileComplete(QStringList *files)
 #else
     setMessagePageText("Your data has been sent to your buddy!");
 #endif
+    if (mFanOutFailures.count() > 0) {
+        setMessagePageText("Your data has been sent, but these buddies could not receive it:\n\n" + mFanOutFailures.join(", "));
+        mFanOutFailures.clear();
+    }
     setMessagePageBackState("send");
 
 
-    // Check for temporary file to delete
-    if (mScreenTempPath != "") {
-
-        QFile file(mScreenTempPath);
-        file.remove();
-        mScreenTempPath = "";
-    }
-
     emit gotoMessagePage();
 }
 
@@ -576,14 +838,6 @@ void GuiBehind::sendFileError(int code)
     setMessagePageBackState("send");
 
 
-    // Check for temporary file to delete
-    if (mScreenTempPath != "") {
-
-        QFile file(mScreenTempPath);
-        file.remove();
-        mScreenTempPath = "";
-    }
-
     emit gotoMessagePage();
 }
 
@@ -602,8 +856,14 @@ bool GuiBehind::eventFilter(QObject *obj, QEvent *event)
 {
     Q_UNUSED(obj);
     // On application activatio, I send a broadcast hello
-    if (event->type() == QEvent::ApplicationActivate)
+    // (not more than once every 30 seconds, switching windows back and
+    // forth would flood the network otherwise)
+    if ((event->type() == QEvent::ApplicationActivate) && mStarted
+            && (!mActivationHello.isValid() || (mActivationHello.elapsed() > ACTIVATION_HELLO_MIN_INTERVAL)))
+    {
+        mActivationHello.start();
         mDuktoProtocol.sayHello(QHostAddress::Broadcast);
+    }
 
     return false;
 }
@@ -627,12 +887,6 @@ void GuiBehind::resetProgressStatus()
 
 }
 
-// Periodic hello sending
-void GuiBehind::periodicHello()
-{
-    mDuktoProtocol.sayHello(QHostAddress::Broadcast);
-}
-
 // Show updates message
 void GuiBehind::showUpdatesMessage()
 {
@@ -851,6 +1105,51 @@ QString GuiBehind::buddyName()
     return mSettings->buddyName();
 }
 
+void GuiBehind::setBandwidthLimit(int kbps)
+{
+    if (kbps < 0) kbps = 0;
+    mSettings->saveBandwidthLimit(kbps);
+    mDuktoProtocol.shaper()->setGlobalLimit(kbps * 1024);
+    emit bandwidthLimitChanged();
+}
+
+int GuiBehind::bandwidthLimit()
+{
+    return mSettings->bandwidthLimit();
+}
+
+// The schedule is edited as a single line, "HH:MM-HH:MM=KBps" entries
+// separated by commas
+void GuiBehind::setBandwidthSchedule(QString schedule)
+{
+    QStringList entries;
+    foreach (const QString &entry, schedule.split(',', Qt::SkipEmptyParts))
+        entries.append(entry.trimmed());
+    mSettings->saveBandwidthSchedule(entries);
+    mDuktoProtocol.shaper()->setSchedule(entries);
+    emit bandwidthScheduleChanged();
+}
+
+QString GuiBehind::bandwidthSchedule()
+{
+    return mSettings->bandwidthSchedule().join(", ");
+}
+
+bool GuiBehind::screenSharing()
+{
+    return mScreenShare->isActive();
+}
+
+QString GuiBehind::screenShareBuddy()
+{
+    return mScreenShareBuddy;
+}
+
+int GuiBehind::screenShareFrame()
+{
+    return mScreenShareFrame;
+}
+
 #if defined(Q_WS_S60)
 void GuiBehind::initConnection()
 {
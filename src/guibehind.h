@@ -23,6 +23,9 @@
 #include <QQmlApplicationEngine>
 #include <QNetworkAccessManager>
 #include <QNetworkReply>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QImage>
 
 #include "buddylistitemmodel.h"
 #include "recentlistitemmodel.h"
@@ -35,6 +38,8 @@ class UpdatesChecker;
 class MiniWebServer;
 class Settings;
 class DuktoWindow;
+class ScreenShareSender;
+class ScreenShareReceiver;
 
 
 class GuiBehind : public QObject
@@ -57,6 +62,12 @@ class GuiBehind : public QObject
     Q_PROPERTY(bool showTermsOnStart READ showTermsOnStart WRITE setShowTermsOnStart NOTIFY showTermsOnStartChanged)
     Q_PROPERTY(bool showUpdateBanner READ showUpdateBanner WRITE setShowUpdateBanner NOTIFY showUpdateBannerChanged)
     Q_PROPERTY(QString buddyName READ buddyName WRITE setBuddyName NOTIFY buddyNameChanged)
+    Q_PROPERTY(int bandwidthLimit READ bandwidthLimit WRITE setBandwidthLimit NOTIFY bandwidthLimitChanged)
+    Q_PROPERTY(QString bandwidthSchedule READ bandwidthSchedule WRITE setBandwidthSchedule NOTIFY bandwidthScheduleChanged)
+    Q_PROPERTY(bool screenSharing READ screenSharing NOTIFY screenSharingChanged)
+    Q_PROPERTY(QString screenShareBuddy READ screenShareBuddy NOTIFY screenShareBuddyChanged)
+    Q_PROPERTY(int screenShareFrame READ screenShareFrame NOTIFY screenShareFrameChanged)
+    Q_PROPERTY(int selectedBuddies READ selectedBuddies NOTIFY selectedBuddiesChanged)
 
 public:
 	explicit GuiBehind( QQmlApplicationEngine * engine);
@@ -100,6 +111,14 @@ public:
     void setShowUpdateBanner(bool show);
     void setBuddyName(QString name);
     QString buddyName();
+    void setBandwidthLimit(int kbps);
+    int bandwidthLimit();
+    void setBandwidthSchedule(QString schedule);
+    QString bandwidthSchedule();
+    bool screenSharing();
+    QString screenShareBuddy();
+    int screenShareFrame();
+    int selectedBuddies();
 
 #if defined(Q_WS_S60)
     void initConnection();
@@ -126,6 +145,12 @@ signals:
     void showTermsOnStartChanged();
     void showUpdateBannerChanged();
     void buddyNameChanged();
+    void bandwidthLimitChanged();
+    void bandwidthScheduleChanged();
+    void screenSharingChanged();
+    void screenShareBuddyChanged();
+    void screenShareFrameChanged();
+    void selectedBuddiesChanged();
 
     // Received by QML
     void transferStart();
@@ -133,27 +158,37 @@ signals:
     void gotoTextSnippet();
     void gotoSendPage();
     void gotoMessagePage();
+    void gotoScreenSharePage();
     void hideAllOverlays();
 
 public slots:
     void showRandomBack();
     void clipboardChanged();
     void remoteDestinationAddressHandler();
-    void periodicHello();
     void showUpdatesMessage();
     void sendScreenStage2();
+    void sendScreenStage3();
+    void firstFrameSwapped();
+    void deferredInit();
 
     // Called by Dukto protocol
     void peerListAdded(Peer peer);
     void peerListRemoved(Peer peer);
     void receiveFileStart(QString senderIp);
-    void transferStatusUpdate(qint64 total, qint64 partial);
+    void transferStatusUpdate(qint64 total, qint64 partial, qint64 bytesPerSecond, int secondsLeft);
     void receiveFileComplete(QStringList *files, qint64 totalSize);
     void receiveTextComplete(QString *text, qint64 totalSize);
     void sendFileComplete(QStringList *files);
     void sendFileError(int code);
     void receiveFileCancelled();
     void sendFileAborted();
+    void fanOutDestinationFailed(QString ip, int code);
+
+    // Called by screen sharing
+    void screenShareStopped(int code);
+    void screenShareStarted(QString senderIp);
+    void screenShareFrameUpdated();
+    void screenShareEnded();
 
     // Called by QML
     void openDestinationFolder();
@@ -162,15 +197,21 @@ public slots:
     void openFile(QString path);
     void changeDestinationFolder();
     void showSendPage(QString ip);
+    void toggleBuddySelection(QString ip);
     void sendSomeFiles();
     void sendFolder();
     void sendClipboardText();
     void sendText();
     void sendScreen();
+    void toggleScreenShare();
+    void closeScreenShare();
     void changeThemeColor(QString color);
     void resetProgressStatus();
     void abortTransfer();
 	void sendFiles(QStringList files);
+    void sendFilesToBuddies(QStringList ips, QStringList files);
+    void setBuddyBandwidthLimit(QString ip, int kbps);
+    int buddyBandwidthLimit(QString ip);
 
 #if defined(Q_WS_S60)
     void connectOpened();
@@ -179,7 +220,7 @@ public slots:
 
 private:
     QTimer *mShowBackTimer;
-    QTimer *mPeriodicHelloTimer;
+    QElapsedTimer mActivationHello;
     QClipboard *mClipboard;
     MiniWebServer *mMiniWebServer;
     Settings *mSettings;
@@ -205,9 +246,18 @@ private:
     QString mMessagePageTitle;
     QString mMessagePageBackState;
     bool mShowUpdateBanner;
-    QString mScreenTempPath;
+    QFutureWatcher<QByteArray> mScreenEncoder;  // Screenshot being encoded
+    QStringList mFanOutFailures;
+    QStringList mSendToBuddies;     // Buddies of the send page, when more than one
+    ScreenShareSender *mScreenShare;
+    ScreenShareReceiver *mScreenShareReceiver;     // Owned by the QML engine
+    QString mScreenShareBuddy;
+    int mScreenShareFrame;
+    bool mStarted;                  // Deferred initialization done
 
     bool prepareStartTransfer(QString *ip, qint16 *port);
+    bool resolveDestination(QString *ip, qint16 *port);
+    static QByteArray encodeScreenshot(QImage screen, QString format, int quality);
     void startTransfer(QStringList files);
     void startTransfer(QString text);
 
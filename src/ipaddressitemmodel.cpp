@@ -27,7 +27,7 @@ IpAddressItemModel::IpAddressItemModel() :  QStandardItemModel(nullptr)
 	roleNames[Ip] = "ip";
 	setItemRoleNames(roleNames);
 
-	refreshIpList();
+	// The list is filled when the IP page is opened
 }
 
 void IpAddressItemModel::addIp(QString ip)
@@ -42,9 +42,12 @@ void IpAddressItemModel::refreshIpList()
 	// Clear current IP list
 	clear();
 
-	// Load IP list
+	// Load IP list (IPv4 first, then IPv6)
 	QList<QHostAddress> addrs = QNetworkInterface::allAddresses();
 	for (int i = 0; i < addrs.length(); i++)
-		if ((addrs[i].protocol() == QAbstractSocket::IPv4Protocol) && (addrs[i].toString() != "127.0.0.1"))
+		if ((addrs[i].protocol() == QAbstractSocket::IPv4Protocol) && !addrs[i].isLoopback())
+			addIp(addrs[i].toString());
+	for (int i = 0; i < addrs.length(); i++)
+		if ((addrs[i].protocol() == QAbstractSocket::IPv6Protocol) && !addrs[i].isLoopback())
 			addIp(addrs[i].toString());
 }
@@ -20,15 +20,81 @@
 #include <QQmlApplicationEngine>
 
 #include "guibehind.h"
+#include "discoverysimulator.h"
+#include "duktodaemon.h"
+#include "webserverbenchmark.h"
+#include "transferbenchmark.h"
+#include "startupprofiler.h"
+#include "tracer.h"
 
 
 int main(int argc, char *argv[])
 {
+	// DUKTO_TRACE=file.json records a Chrome trace of the whole run
+	Tracer::start();
+
+	// Headless discovery benchmark, no GUI at all
+	for (int i = 1; i < argc; i++)
+		if (qstrcmp(argv[i], "--simulate-discovery") == 0)
+		{
+			QCoreApplication app(argc, argv);
+			DiscoverySimulator sim;
+			if (!sim.configure(app.arguments())) return 1;
+			QObject::connect(&sim, SIGNAL(finished()), &app, SLOT(quit()));
+			sim.start();
+			return app.exec();
+		}
+
+	// Avatar server load benchmark
+	for (int i = 1; i < argc; i++)
+		if (qstrcmp(argv[i], "--benchmark-avatar") == 0)
+		{
+			QCoreApplication app(argc, argv);
+			WebServerBenchmark bench;
+			if (!bench.configure(app.arguments())) return 1;
+			QObject::connect(&bench, SIGNAL(finished()), &app, SLOT(quit()), Qt::QueuedConnection);
+			bench.start();
+			return app.exec();
+		}
+
+	// Loopback transfer throughput benchmark, one JSON line per run
+	for (int i = 1; i < argc; i++)
+		if (qstrcmp(argv[i], "--benchmark-transfer") == 0)
+		{
+			QCoreApplication app(argc, argv);
+			TransferBenchmark bench;
+			if (!bench.configure(app.arguments())) return 1;
+			QObject::connect(&bench, SIGNAL(finished(int)), &app, SLOT(exit(int)), Qt::QueuedConnection);
+			bench.start();
+			return app.exec();
+		}
+
+	// Headless modes: daemon, send and receive from the command line
+	if (DuktoDaemon::isHeadlessCommand(argc, argv))
+	{
+		QCoreApplication app(argc, argv);
+		DuktoDaemon daemon;
+		if (!daemon.configure(app.arguments())) return 1;
+		QObject::connect(&daemon, SIGNAL(finished(int)), &app, SLOT(exit(int)));
+		if (!daemon.start()) return 1;
+		return app.exec();
+	}
+
+	// Startup profile: dukto --benchmark-startup quits after the first frame
+	// and the deferred initialization, DUKTO_STARTUP_PROFILE=1 only prints it
+	bool startupBenchmark = false;
+	for (int i = 1; i < argc; i++)
+		if (qstrcmp(argv[i], "--benchmark-startup") == 0)
+			startupBenchmark = true;
+	StartupProfiler::start(startupBenchmark);
+
 	QCoreApplication::setAttribute(Qt::AA_EnableHighDpiScaling);
 
 	QGuiApplication app(argc, argv);
+	StartupProfiler::mark("application");
 
 	QQmlApplicationEngine enginge;
+	StartupProfiler::mark("qml engine");
 	GuiBehind gb(&enginge);
 
 
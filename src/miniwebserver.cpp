@@ -19,65 +19,143 @@
 #include "miniwebserver.h"
 
 #include <QTcpSocket>
-#include <QStringList>
-#include <QDateTime>
-#include <QFile>
 #include <QImage>
 #include <QBuffer>
+#include <QTimer>
 
 #include "platform.h"
+#include "tracer.h"
 
-MiniWebServer::MiniWebServer(int port)
+#define HTTP_MAX_REQUEST_SIZE 8192
+#define HTTP_KEEPALIVE_TIMEOUT 30000
+#define HTTP_IDLE_CHECK_INTERVAL 5000
+
+MiniWebServer::MiniWebServer(int port) :
+    mIdleTimer(nullptr)
 {
     // Load and convert avatar image
     QString path = Platform::getAvatarPath();
     if (path != "")
+        start(port, QImage(path));
+}
+
+MiniWebServer::MiniWebServer(int port, const QImage &avatar) :
+    mIdleTimer(nullptr)
+{
+    start(port, avatar);
+}
+
+void MiniWebServer::start(int port, const QImage &avatar)
+{
+    QByteArray avatarData;
+    QImage scaled = avatar.scaled(64, 64, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    QBuffer tmp(&avatarData);
+    tmp.open(QIODevice::WriteOnly);
+    scaled.save(&tmp, "PNG");
+
+    // Responses, ready to be written
+    for (int keepAlive = 0; keepAlive < 2; keepAlive++)
     {
-        QImage img(path);
-        QImage scaled = img.scaled(64, 64, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
-        QBuffer tmp(&mAvatarData);
-        tmp.open(QIODevice::WriteOnly);
-        scaled.save(&tmp, "PNG");
-
-        // Start server
-        listen(QHostAddress::Any, port);
+        mAvatarHeadResponse[keepAlive] = "HTTP/1.1 200 OK\r\n"
+                                         "Content-Type: image/png\r\n"
+                                         "Content-Length: " + QByteArray::number(avatarData.size()) + "\r\n"
+                                         "Cache-Control: max-age=3600\r\n"
+                                         "Connection: " + QByteArray(keepAlive ? "keep-alive" : "close") + "\r\n"
+                                         "\r\n";
+        mAvatarResponse[keepAlive] = mAvatarHeadResponse[keepAlive] + avatarData;
     }
+    mBadRequestResponse = "HTTP/1.1 400 Bad Request\r\n"
+                          "Content-Length: 0\r\n"
+                          "Connection: close\r\n"
+                          "\r\n";
+
+    mClock.start();
+    mIdleTimer = new QTimer(this);
+    connect(mIdleTimer, SIGNAL(timeout()), this, SLOT(closeIdleClients()));
+    mIdleTimer->start(HTTP_IDLE_CHECK_INTERVAL);
+
+    // Start server
+    listen(QHostAddress::Any, port);
 }
 
-void MiniWebServer::incomingConnection(int handle)
+void MiniWebServer::incomingConnection(qintptr handle)
 {
+    Tracer::instant("avatar", "accept");
     QTcpSocket* s = new QTcpSocket(this);
     connect(s, SIGNAL(readyRead()), this, SLOT(readClient()));
     connect(s, SIGNAL(disconnected()), this, SLOT(discardClient()));
     s->setSocketDescriptor(handle);
+    mClients[s].lastActivity = mClock.elapsed();
 }
 
 void MiniWebServer::readClient()
 {
     QTcpSocket* socket = (QTcpSocket*)sender();
-    if (socket->canReadLine()) {
-        QStringList tokens = QString(socket->readLine()).split(QRegExp("[ \r\n][ \r\n]*"));
-        if (tokens[0] == "GET") {
-
-            QTextStream os(socket);
-            os.setAutoDetectUnicode(true);
-            os << "HTTP/1.0 200 OK\r\n"
-                "Content-Type: image/png\r\n"
-                "Content-Length: " << mAvatarData.size() << "\r\n"
-                "\r\n";
-            os.flush();
-
-            QDataStream ds(socket);
-            ds.writeRawData(mAvatarData.data(), mAvatarData.size());
-
-            socket->close();
-            if (socket->state() == QTcpSocket::UnconnectedState) delete socket;
+    if (!mClients.contains(socket)) return;
+    Client &c = mClients[socket];
+    c.buffer.append(socket->readAll());
+    c.lastActivity = mClock.elapsed();
+
+    // Every complete request in the buffer (pipelining)
+    int end;
+    while ((end = c.buffer.indexOf("\r\n\r\n")) >= 0)
+    {
+        QByteArray head = c.buffer.left(end);
+        c.buffer.remove(0, end + 4);
+        if (!handleRequest(socket, head)) {
+            mClients.remove(socket);
+            socket->disconnectFromHost();
+            return;
         }
     }
+
+    if (c.buffer.size() > HTTP_MAX_REQUEST_SIZE) {
+        socket->write(mBadRequestResponse);
+        mClients.remove(socket);
+        socket->disconnectFromHost();
+    }
+}
+
+// Writes the response, returns false when the connection has to be closed
+bool MiniWebServer::handleRequest(QTcpSocket *socket, const QByteArray &head)
+{
+    TraceSpan span("avatar", "request");
+    int lineEnd = head.indexOf("\r\n");
+    QByteArray requestLine = (lineEnd < 0) ? head : head.left(lineEnd);
+    int sp = requestLine.indexOf(' ');
+    QByteArray method = requestLine.left(sp);
+
+    if ((method != "GET") && (method != "HEAD")) {
+        socket->write(mBadRequestResponse);
+        return false;
+    }
+
+    // HTTP/1.1 keeps the connection by default, HTTP/1.0 only on request
+    QByteArray headers = head.mid(lineEnd + 2).toLower();
+    bool keepAlive = requestLine.endsWith("HTTP/1.1") ? !headers.contains("connection: close")
+                                                      : headers.contains("connection: keep-alive");
+
+    socket->write((method == "HEAD") ? mAvatarHeadResponse[keepAlive] : mAvatarResponse[keepAlive]);
+    return keepAlive;
 }
 
 void MiniWebServer::discardClient()
 {
     QTcpSocket* socket = (QTcpSocket*)sender();
+    mClients.remove(socket);
     socket->deleteLater();
 }
+
+void MiniWebServer::closeIdleClients()
+{
+    qint64 now = mClock.elapsed();
+    QMutableHashIterator<QTcpSocket*, Client> i(mClients);
+    while (i.hasNext())
+    {
+        i.next();
+        if (now - i.value().lastActivity < HTTP_KEEPALIVE_TIMEOUT) continue;
+        QTcpSocket *socket = i.key();
+        i.remove();
+        socket->disconnectFromHost();
+    }
+}
@@ -20,25 +20,48 @@
 #define MINIWEBSERVER_H
 
 #include <QTcpServer>
+#include <QHash>
+#include <QElapsedTimer>
 
-// FROM: http://doc.qt.nokia.com/solutions/4/qtservice/qtservice-example-server.html
+class QTcpSocket;
+class QImage;
+class QTimer;
 
+// Serves the avatar over HTTP/1.1. Connections are kept alive and
+// requests can be pipelined; every response is built once at startup
+// and sent with a single write.
 class MiniWebServer : public QTcpServer
 {
     Q_OBJECT
 
 public:
     MiniWebServer(int port);
+    MiniWebServer(int port, const QImage &avatar);
 
 protected:
-    virtual void incomingConnection(int handle);
+    virtual void incomingConnection(qintptr handle);
 
 private slots:
      void readClient();
      void discardClient();
+     void closeIdleClients();
 
 private:
-     QByteArray mAvatarData;
+     struct Client {
+         QByteArray buffer;         // Request data not yet handled
+         qint64 lastActivity;       // ms, mClock time
+     };
+
+     void start(int port, const QImage &avatar);
+     bool handleRequest(QTcpSocket *socket, const QByteArray &head);
+
+     // Responses, indexed by keep-alive
+     QByteArray mAvatarResponse[2];     // Headers and PNG body
+     QByteArray mAvatarHeadResponse[2]; // Same, without body (HEAD)
+     QByteArray mBadRequestResponse;
+     QHash<QTcpSocket*, Client> mClients;
+     QElapsedTimer mClock;
+     QTimer *mIdleTimer;
 
 };
 
@@ -0,0 +1,145 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2011 Emanuele Colombo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "networkinterfacemonitor.h"
+
+#include <QSocketNotifier>
+
+#if defined(Q_OS_LINUX)
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <unistd.h>
+#include <string.h>
+#endif
+
+#define FALLBACK_REFRESH_INTERVAL 60000
+#define COALESCE_INTERVAL 250
+
+NetworkInterfaceMonitor::NetworkInterfaceMonitor(QObject *parent) :
+    QObject(parent), mNetlinkSocket(-1), mNotifier(nullptr)
+{
+    mCoalesceTimer.setSingleShot(true);
+    mCoalesceTimer.setInterval(COALESCE_INTERVAL);
+    connect(&mCoalesceTimer, SIGNAL(timeout()), this, SLOT(refresh()));
+
+    mFallbackTimer.setInterval(FALLBACK_REFRESH_INTERVAL);
+    connect(&mFallbackTimer, SIGNAL(timeout()), this, SLOT(refresh()));
+    mFallbackTimer.start();
+
+#if defined(Q_OS_LINUX)
+    // Link and address changes, IPv4 and IPv6
+    mNetlinkSocket = ::socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (mNetlinkSocket != -1)
+    {
+        struct sockaddr_nl addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.nl_family = AF_NETLINK;
+        addr.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+        if (::bind(mNetlinkSocket, (struct sockaddr*) &addr, sizeof(addr)) == 0)
+        {
+            mNotifier = new QSocketNotifier(mNetlinkSocket, QSocketNotifier::Read, this);
+            connect(mNotifier, SIGNAL(activated(int)), this, SLOT(systemNotification()));
+        }
+        else
+        {
+            ::close(mNetlinkSocket);
+            mNetlinkSocket = -1;
+        }
+    }
+#endif
+
+    refresh();
+}
+
+NetworkInterfaceMonitor::~NetworkInterfaceMonitor()
+{
+#if defined(Q_OS_LINUX)
+    if (mNetlinkSocket != -1) ::close(mNetlinkSocket);
+#endif
+}
+
+// The content of the messages doesn't matter, any of them
+// means the table has to be built again
+void NetworkInterfaceMonitor::systemNotification()
+{
+#if defined(Q_OS_LINUX)
+    char buffer[4096];
+    while (::recv(mNetlinkSocket, buffer, sizeof(buffer), 0) > 0) { }
+#endif
+    mCoalesceTimer.start();
+}
+
+void NetworkInterfaceMonitor::refresh()
+{
+    QList<QNetworkInterface> ifaces = QNetworkInterface::allInterfaces();
+    QList<QHostAddress> broadcasts, local;
+    QList<QNetworkInterface> multicast4, multicast6;
+    QStringList state;
+
+    for (int i = 0; i < ifaces.size(); i++)
+    {
+        QNetworkInterface::InterfaceFlags flags = ifaces[i].flags();
+        bool multicast = (flags & QNetworkInterface::IsUp) && (flags & QNetworkInterface::IsRunning)
+                && (flags & QNetworkInterface::CanMulticast) && !(flags & QNetworkInterface::IsLoopBack);
+        bool has4 = false, has6 = false;
+        QString s = ifaces[i].name() + "|" + QString::number(flags);
+
+        QList<QNetworkAddressEntry> addrs = ifaces[i].addressEntries();
+        for (int j = 0; j < addrs.size(); j++)
+        {
+            s += "|" + addrs[j].ip().toString();
+            local.append(addrs[j].ip());
+            if (addrs[j].ip().protocol() == QAbstractSocket::IPv4Protocol)
+            {
+                has4 = true;
+                if ((addrs[j].broadcast().toString() != "") && !broadcasts.contains(addrs[j].broadcast()))
+                    broadcasts.append(addrs[j].broadcast());
+            }
+            else if (addrs[j].ip().protocol() == QAbstractSocket::IPv6Protocol)
+                has6 = true;
+        }
+
+        if (multicast && has4) multicast4.append(ifaces[i]);
+        if (multicast && has6) multicast6.append(ifaces[i]);
+        state.append(s);
+    }
+
+    mInterfaces = ifaces;
+    mBroadcasts = broadcasts;
+    mMulticastIPv4 = multicast4;
+    mMulticastIPv6 = multicast6;
+    mLocalAddresses = local;
+    bool changed = (state != mState);
+    mState = state;
+    if (changed) emit interfacesChanged();
+}
+
+// One of the addresses of this host, the scope of link-local ones aside
+bool NetworkInterfaceMonitor::isLocalAddress(const QHostAddress &address) const
+{
+    if (address.isLoopback()) return true;
+    QHostAddress plain = address;
+    plain.setScopeId(QString());
+    foreach (QHostAddress a, mLocalAddresses)
+    {
+        a.setScopeId(QString());
+        if (a == plain) return true;
+    }
+    return false;
+}
@@ -0,0 +1,72 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2011 Emanuele Colombo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef NETWORKINTERFACEMONITOR_H
+#define NETWORKINTERFACEMONITOR_H
+
+#include <QObject>
+#include <QList>
+#include <QStringList>
+#include <QTimer>
+#include <QtNetwork/QHostAddress>
+#include <QtNetwork/QNetworkInterface>
+
+class QSocketNotifier;
+
+// Cached table of the local interfaces, of their broadcast addresses
+// and of the ones that can be used for multicast discovery.
+// Enumerating the interfaces is expensive on hosts with many virtual
+// ones, so it's done again only when the system reports a change of
+// links or addresses (netlink on Linux) and, as a fallback for the
+// other systems, every minute.
+class NetworkInterfaceMonitor : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit NetworkInterfaceMonitor(QObject *parent = nullptr);
+    virtual ~NetworkInterfaceMonitor();
+    inline const QList<QHostAddress>& broadcastAddresses() const { return mBroadcasts; }
+    inline const QList<QNetworkInterface>& interfaces() const { return mInterfaces; }
+    inline const QList<QNetworkInterface>& multicastInterfacesIPv4() const { return mMulticastIPv4; }
+    inline const QList<QNetworkInterface>& multicastInterfacesIPv6() const { return mMulticastIPv6; }
+    bool isLocalAddress(const QHostAddress &address) const;
+
+public slots:
+    void refresh();
+
+signals:
+    void interfacesChanged();
+
+private slots:
+    void systemNotification();
+
+private:
+    QList<QNetworkInterface> mInterfaces;
+    QList<QHostAddress> mBroadcasts;
+    QList<QNetworkInterface> mMulticastIPv4;
+    QList<QNetworkInterface> mMulticastIPv6;
+    QList<QHostAddress> mLocalAddresses;
+    QStringList mState;             // Names, flags and addresses, to detect changes
+    QTimer mFallbackTimer;
+    QTimer mCoalesceTimer;          // A change usually comes as a burst of messages
+    int mNetlinkSocket;
+    QSocketNotifier *mNotifier;
+};
+
+#endif // NETWORKINTERFACEMONITOR_H
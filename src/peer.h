@@ -24,11 +24,43 @@
 class Peer
 {
 public:
-    Peer() { }
-    inline Peer(QHostAddress a, QString n, qint16 p) { address = a; name = n; port = p; }
+    Peer() { port = 0; caps = 0; lastSeen = 0; verified = true; heartbeatInterval = 0; identityTag = 0; probes = 0; lastProbe = 0; }
+    inline Peer(QHostAddress a, QString n, qint16 p, quint32 c = 0) {
+        address = a; name = n; port = p; caps = c; lastSeen = 0; verified = true;
+        heartbeatInterval = 0; identityTag = 0; probes = 0; lastProbe = 0;
+    }
     QHostAddress address;
     QString name;
     qint16 port;
+    quint32 caps;       // Capabilities advertised in the hello message
+    qint64 lastSeen;    // Last message received, in ms (DuktoProtocol clock)
+    bool verified;      // False for buddies loaded from the cache, until they answer
+
+    // Presence
+    qint32 heartbeatInterval;   // ms, announced in the heartbeats (0 = only hellos)
+    quint32 identityTag;        // Digest of the last hello, repeated in the heartbeats
+    int probes;                 // Probes sent since the buddy went silent
+    qint64 lastProbe;           // Time of the last probe (DuktoProtocol clock)
+
+    // Identity, from the binary part of the hello message
+    QString user;
+    QString host;
+    QString platform;
+    QByteArray avatarHash;  // MD5 of the avatar image, empty if unknown
+    QByteArray instanceId;  // Stable ID of the Dukto installation, empty if unknown
+
+    // Fills user, host and platform from a legacy "user at host (platform)" name
+    inline void splitLegacyName() {
+        int open = name.lastIndexOf(" (");
+        int at = (open >= 4) ? name.lastIndexOf(" at ", open - 4) : -1;
+        if ((at < 0) || !name.endsWith(')')) {
+            user = name;
+            return;
+        }
+        user = name.left(at);
+        host = name.mid(at + 4, open - at - 4);
+        platform = name.mid(open + 2, name.size() - open - 3);
+    }
 };
 
 #endif // PEER_H
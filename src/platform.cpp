@@ -22,6 +22,7 @@
 #include <QHostInfo>
 #include <QFile>
 #include <QDir>
+#include <QTextStream>
 #include <QMessageBox>
 
 #if defined(Q_OS_MAC)
@@ -156,7 +157,19 @@ QString Platform::getPlatformName()
 }
 
 // Returns the platform avatar path
+// (looked up once, it takes several filesystem probes)
 QString Platform::getAvatarPath()
+{
+    static QString avatarPath;
+    static bool found = false;
+    if (!found) {
+        avatarPath = lookupAvatarPath();
+        found = true;
+    }
+    return avatarPath;
+}
+
+QString Platform::lookupAvatarPath()
 {
 #if defined(Q_OS_WIN)
     QString username = getSystemUsername().replace("\\", "+");
@@ -222,12 +235,9 @@ QString Platform::getLinuxAvatarPath()
     bool found = false;
     while (true) {
         line = ts.readLine();
-		if (line.isnullptr()) break;
+		if (line.isNull()) break;
         if (line.startsWith("Icon=")) {
-            QRegExp re("^Icon=(.*)$");
-            if (re.indexIn(line) == -1) continue;
-            QStringList pathlist = re.capturedTexts();
-            path = pathlist[1];
+            path = line.mid(5);
             found = true;
             break;
         }
@@ -34,6 +34,7 @@ public:
 
 // private:
     Platform() {}
+    static QString lookupAvatarPath();
 #if defined(Q_OS_LINUX)
     static QString getLinuxAvatarPath();
 #elif defined(Q_OS_MAC)
@@ -19,9 +19,24 @@
 #include "recentlistitemmodel.h"
 
 #include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QSet>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QStandardPaths>
+
+#define HISTORY_LOG "history.jsonl"
+#define HISTORY_TEXT_FOLDER "texts"
+#define HISTORY_PAGE 50                 // Entries loaded at startup and by each fetchMore()
+#define HISTORY_MAX_ROWS 200            // Entries kept in memory, unless the view paged further
+#define HISTORY_INLINE_TEXT 1024        // Longer texts are saved in their own file
+#define HISTORY_MAX_LOG_SIZE (4 * 1048576)
+#define HISTORY_KEEP_ENTRIES 5000       // Entries kept when the log is compacted
+#define HISTORY_READ_BLOCK 65536
 
 RecentListItemModel::RecentListItemModel() :
-    QStandardItemModel(nullptr)
+    QStandardItemModel(nullptr), mLoadedFrom(0), mViewRows(0)
 {
     QHash<int, QByteArray> roleNames;
     roleNames[Name] = "name";
@@ -31,16 +46,74 @@ RecentListItemModel::RecentListItemModel() :
     roleNames[DateTime] = "dateTime";
     roleNames[Sender] = "sender";
     roleNames[Size] = "size";
+    roleNames[TextFile] = "textFile";
     setItemRoleNames(roleNames);
 }
 
+// Log of the previous sessions, read after the first frame
+void RecentListItemModel::load()
+{
+    if (!mDir.isEmpty()) return;
+    mDir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/history";
+    QDir().mkpath(mDir + "/" + HISTORY_TEXT_FOLDER);
+    mLog.setFileName(mDir + "/" + HISTORY_LOG);
+    if (mLog.size() > HISTORY_MAX_LOG_SIZE) compactLog();
+    mLog.open(QIODevice::Append);
+    mLoadedFrom = mLog.size();
+    loadOlder(HISTORY_PAGE);
+}
+
 void RecentListItemModel::addRecent(QString name, QString value, QString type, QString sender, qint64 size)
+{
+    if (mDir.isEmpty()) load();
+
+    QJsonObject entry;
+    entry["name"] = name;
+    entry["type"] = type;
+    entry["sender"] = sender;
+    entry["size"] = size;
+    entry["time"] = QDateTime::currentDateTime().toString(Qt::ISODate);
+
+    // Long texts don't go into the log, nor into the model
+    QByteArray text = value.toUtf8();
+    if ((type == "text") && (text.size() > HISTORY_INLINE_TEXT))
+    {
+        QFile f(mDir + "/" + HISTORY_TEXT_FOLDER + "/" + QString::number(QDateTime::currentMSecsSinceEpoch()) + ".txt");
+        if (f.open(QIODevice::WriteOnly | QIODevice::Truncate) && (f.write(text) == text.size())) {
+            entry["textFile"] = f.fileName();
+            value.clear();
+        }
+    }
+    entry["value"] = value;
+
+    qint64 offset = -1;
+    if (mLog.isOpen())
+    {
+        offset = mLog.size();
+        mLog.write(QJsonDocument(entry).toJson(QJsonDocument::Compact) + "\n");
+        mLog.flush();
+    }
+    insertRow(0, createItem(entry, offset));
+
+    // Older entries can be loaded again from the log; the rows the
+    // view paged in are kept
+    if (rowCount() > qMax(HISTORY_MAX_ROWS, mViewRows))
+    {
+        removeRow(rowCount() - 1);
+        qint64 last = item(rowCount() - 1)->data(RecentListItemModel::LogOffset).toLongLong();
+        if (last >= 0) mLoadedFrom = last;
+    }
+}
+
+QStandardItem* RecentListItemModel::createItem(const QJsonObject &entry, qint64 offset)
 {
     QStandardItem* it = new QStandardItem();
+    QString type = entry.value("type").toString();
+    qint64 size = (qint64) entry.value("size").toDouble();
 
     // Format timestamp
-    QDateTime now = QDateTime::currentDateTime();
-    QString datetime = now.toString(Qt::SystemLocaleShortDate);
+    QDateTime time = QDateTime::fromString(entry.value("time").toString(), Qt::ISODate);
+    QString datetime = time.toString(Qt::SystemLocaleShortDate);
 
     // Convert size data
     QString sizeFormatted;
@@ -60,13 +133,109 @@ void RecentListItemModel::addRecent(QString name, QString value, QString type, Q
         it->setData("res/RecentFiles.png", RecentListItemModel::TypeIcon);
 
     if (type == "text")
-        it->setData(name, RecentListItemModel::Name);
+        it->setData(entry.value("name").toString(), RecentListItemModel::Name);
     else
-        it->setData(name + " (" + sizeFormatted + ")", RecentListItemModel::Name);
-    it->setData(value, RecentListItemModel::Value);
+        it->setData(entry.value("name").toString() + " (" + sizeFormatted + ")", RecentListItemModel::Name);
+    it->setData(entry.value("value").toString(), RecentListItemModel::Value);
     it->setData(type, RecentListItemModel::Type);
     it->setData(datetime, RecentListItemModel::DateTime);
-    it->setData(sender, RecentListItemModel::Sender);
+    it->setData(entry.value("sender").toString(), RecentListItemModel::Sender);
     it->setData(sizeFormatted, RecentListItemModel::Size);
-    insertRow(0, it);
+    it->setData(entry.value("textFile").toString(), RecentListItemModel::TextFile);
+    it->setData(offset, RecentListItemModel::LogOffset);
+    return it;
+}
+
+bool RecentListItemModel::canFetchMore(const QModelIndex &parent) const
+{
+    return !parent.isValid() && (mLoadedFrom > 0);
+}
+
+// Paging goes back to the start of the log, the memory bound only
+// applies to the entries nobody scrolled to
+void RecentListItemModel::fetchMore(const QModelIndex &parent)
+{
+    if (parent.isValid()) return;
+    loadOlder(HISTORY_PAGE);
+    mViewRows = rowCount();
+}
+
+// Appends to the model the entries written before the oldest one loaded
+void RecentListItemModel::loadOlder(int count)
+{
+    if ((count <= 0) || (mLoadedFrom <= 0)) return;
+
+    QList<QPair<qint64, QByteArray> > lines = readOlder(mLoadedFrom, count);
+    for (int i = 0; i < lines.size(); i++)
+    {
+        QJsonDocument doc = QJsonDocument::fromJson(lines.at(i).second);
+        if (doc.isObject()) appendRow(createItem(doc.object(), lines.at(i).first));
+        mLoadedFrom = lines.at(i).first;
+    }
+    if (lines.size() < count) mLoadedFrom = 0;
+}
+
+// Reads backwards up to count lines of the log ending before the given
+// offset, newest first, along with the offset where each one starts
+QList<QPair<qint64, QByteArray> > RecentListItemModel::readOlder(qint64 before, int count)
+{
+    QList<QPair<qint64, QByteArray> > lines;
+    QFile f(mLog.fileName());
+    if (!f.open(QIODevice::ReadOnly)) return lines;
+
+    QByteArray pending;         // Read but not yet split, it starts at pos
+    qint64 pos = before;
+    while (lines.size() < count)
+    {
+        int nl = (pending.size() > 1) ? pending.lastIndexOf('\n', pending.size() - 2) : -1;
+        if (nl >= 0) {
+            QByteArray line = pending.mid(nl + 1).trimmed();
+            pending.truncate(nl + 1);
+            if (!line.isEmpty()) lines.append(qMakePair(pos + nl + 1, line));
+            continue;
+        }
+        if (pos == 0) {
+            QByteArray line = pending.trimmed();
+            if (!line.isEmpty()) lines.append(qMakePair((qint64) 0, line));
+            break;
+        }
+        qint64 start = qMax((qint64) 0, pos - HISTORY_READ_BLOCK);
+        f.seek(start);
+        pending.prepend(f.read(pos - start));
+        pos = start;
+    }
+    return lines;
+}
+
+// Keeps only the latest entries of a log grown too large, along with
+// their text files
+void RecentListItemModel::compactLog()
+{
+    QList<QPair<qint64, QByteArray> > lines = readOlder(mLog.size(), HISTORY_KEEP_ENTRIES);
+    QFile tmp(mLog.fileName() + ".tmp");
+    if (!tmp.open(QIODevice::WriteOnly | QIODevice::Truncate)) return;
+
+    QSet<QString> texts;
+    for (int i = lines.size() - 1; i >= 0; i--)
+    {
+        tmp.write(lines.at(i).second + "\n");
+        QString textFile = QJsonDocument::fromJson(lines.at(i).second).object().value("textFile").toString();
+        if (!textFile.isEmpty()) texts.insert(QFileInfo(textFile).fileName());
+    }
+    tmp.close();
+    QFile::remove(mLog.fileName());
+    tmp.rename(mLog.fileName());
+
+    QDir textDir(mDir + "/" + HISTORY_TEXT_FOLDER);
+    foreach (const QString &name, textDir.entryList(QDir::Files))
+        if (!texts.contains(name)) textDir.remove(name);
+}
+
+// Text of an entry saved out of the log
+QString RecentListItemModel::loadText(QString path)
+{
+    if (QFileInfo(path).absolutePath() != QDir(mDir + "/" + HISTORY_TEXT_FOLDER).absolutePath()) return "";
+    QFile f(path);
+    if (!f.open(QIODevice::ReadOnly)) return "";
+    return QString::fromUtf8(f.readAll());
 }
@@ -20,13 +20,27 @@
 #define RECENTLISTITEMMODEL_H
 
 #include <QStandardItemModel>
+#include <QFile>
+#include <QList>
+#include <QPair>
 
+class QJsonObject;
+
+// Transfer history. Every entry is appended to a log on disk (one JSON
+// object per line), the model only holds the latest entries and loads
+// the older ones a page at a time when the view scrolls down to them,
+// back to the first entry of the log.
+// Long text snippets are saved in their own files, outside of the log.
 class RecentListItemModel : public QStandardItemModel
 {
     Q_OBJECT
 public:
     explicit RecentListItemModel();
+    void load();
     void addRecent(QString name, QString value, QString type, QString sender, qint64 size);
+    bool canFetchMore(const QModelIndex &parent) const;
+    void fetchMore(const QModelIndex &parent);
+    Q_INVOKABLE QString loadText(QString path);
 
     enum RecentRoles {
         Name = Qt::UserRole + 1,
@@ -35,13 +49,25 @@ public:
         TypeIcon,
         DateTime,
         Sender,
-        Size
+        Size,
+        TextFile,
+        LogOffset
     };
 
 signals:
 
 public slots:
 
+private:
+    QStandardItem* createItem(const QJsonObject &entry, qint64 offset);
+    QList<QPair<qint64, QByteArray> > readOlder(qint64 before, int count);
+    void loadOlder(int count);
+    void compactLog();
+
+    QString mDir;                   // History folder
+    QFile mLog;                     // Append-only log
+    qint64 mLoadedFrom;             // Log offset of the oldest entry in the model
+    int mViewRows;                  // Rows the view paged in, they aren't trimmed
 };
 
 #endif // RECENTLISTITEMMODEL_H
@@ -0,0 +1,357 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2011 Emanuele Colombo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "screenshare.h"
+
+#include <QGuiApplication>
+#include <QScreen>
+#include <QPixmap>
+#include <QTimer>
+#include <QMutexLocker>
+#include <QtEndian>
+
+#include <string.h>
+
+#include "bandwidthshaper.h"
+#include "buddylistitemmodel.h"
+
+#define SCREENSHARE_MAGIC "DKSS"
+#define SCREENSHARE_VERSION 1
+#define SCREENSHARE_HEADER_SIZE 7
+#define SCREENSHARE_TILE_SIZE 64
+#define SCREENSHARE_COMPRESSION 3               // zlib level, fast enough for every frame
+#define SCREENSHARE_MAX_FRAME (64 * 1048576)    // Larger frames mean a broken stream
+#define SCREENSHARE_MAX_PIXELS (7680 * 4320)    // Largest screen accepted (8K)
+
+static void appendUInt16(QByteArray &a, quint16 v)
+{
+    uchar b[2];
+    qToBigEndian<quint16>(v, b);
+    a.append((char*) b, sizeof(b));
+}
+
+static void appendUInt32(QByteArray &a, quint32 v)
+{
+    uchar b[4];
+    qToBigEndian<quint32>(v, b);
+    a.append((char*) b, sizeof(b));
+}
+
+static inline quint16 readUInt16(const char *p)
+{
+    return qFromBigEndian<quint16>((const uchar*) p);
+}
+
+static inline quint32 readUInt32(const char *p)
+{
+    return qFromBigEndian<quint32>((const uchar*) p);
+}
+
+// ------------------------------------------------------------
+// ScreenShareSender
+
+ScreenShareSender::ScreenShareSender(QObject *parent) :
+    QObject(parent), mSocket(nullptr), mInterval(500), mShaper(nullptr)
+{
+    mTimer = new QTimer(this);
+    connect(mTimer, SIGNAL(timeout()), this, SLOT(captureFrame()));
+}
+
+ScreenShareSender::~ScreenShareSender()
+{
+    stop();
+}
+
+void ScreenShareSender::start(QString ip, qint16 port)
+{
+    stop();
+    mIp = ip;
+    mSocket = new QTcpSocket(this);
+    connect(mSocket, SIGNAL(connected()), this, SLOT(connected()));
+    connect(mSocket, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(socketError(QAbstractSocket::SocketError)));
+    mSocket->connectToHost(ip, port);
+}
+
+void ScreenShareSender::stop()
+{
+    mTimer->stop();
+    mPrevious = QImage();
+    if (!mSocket) return;
+    mSocket->disconnect(this);
+    mSocket->disconnectFromHost();
+    mSocket->deleteLater();
+    mSocket = nullptr;
+}
+
+void ScreenShareSender::connected()
+{
+    QByteArray header(SCREENSHARE_MAGIC);
+    header.append((char) SCREENSHARE_VERSION);
+    appendUInt16(header, SCREENSHARE_TILE_SIZE);
+    mSocket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    mSocket->write(header);
+
+    // The first frame goes out at once, all of its tiles are new
+    captureFrame();
+    mTimer->start(mInterval);
+}
+
+void ScreenShareSender::captureFrame()
+{
+    if (!mSocket || (mSocket->state() != QAbstractSocket::ConnectedState)) return;
+
+    // The previous frame is still on its way: this one is skipped,
+    // a slow link gets fewer frames instead of a growing queue
+    if (mSocket->bytesToWrite() > 0) return;
+    if (mShaper && (mShaper->allowance(mIp, 1) == 0)) return;
+
+    QScreen *screen = QGuiApplication::primaryScreen();
+    if (!screen) return;
+    QImage frame = screen->grabWindow(0).toImage().convertToFormat(QImage::Format_RGB32);
+    if (frame.isNull()) return;
+
+    QByteArray d = encodeFrame(frame);
+    mPrevious = frame;
+    if (d.isEmpty()) return;
+
+    if (mShaper) mShaper->consume(mIp, d.size());
+    mSocket->write(d);
+}
+
+// Only the tiles that differ from the previous frame are compressed;
+// the unchanged ones cost a memcmp() and nothing on the wire
+QByteArray ScreenShareSender::encodeFrame(const QImage &frame)
+{
+    int width = qMin(frame.width(), 65535);
+    int height = qMin(frame.height(), 65535);
+    bool full = (mPrevious.size() != frame.size());
+
+    QByteArray tiles;
+    quint32 count = 0;
+    for (int y = 0; y < height; y += SCREENSHARE_TILE_SIZE)
+    {
+        int th = qMin(SCREENSHARE_TILE_SIZE, height - y);
+        for (int x = 0; x < width; x += SCREENSHARE_TILE_SIZE)
+        {
+            int tw = qMin(SCREENSHARE_TILE_SIZE, width - x);
+            int rowBytes = tw * 4;
+
+            bool changed = full;
+            for (int i = 0; !changed && (i < th); i++)
+                changed = (memcmp(frame.constScanLine(y + i) + x * 4,
+                                  mPrevious.constScanLine(y + i) + x * 4, rowBytes) != 0);
+            if (!changed) continue;
+
+            QByteArray raw;
+            raw.reserve(rowBytes * th);
+            for (int i = 0; i < th; i++)
+                raw.append((const char*) frame.constScanLine(y + i) + x * 4, rowBytes);
+            QByteArray packed = qCompress(raw, SCREENSHARE_COMPRESSION);
+
+            appendUInt16(tiles, x / SCREENSHARE_TILE_SIZE);
+            appendUInt16(tiles, y / SCREENSHARE_TILE_SIZE);
+            appendUInt32(tiles, packed.size());
+            tiles.append(packed);
+            count++;
+        }
+    }
+
+    // Nothing changed, nothing to send
+    if (count == 0) return QByteArray();
+
+    QByteArray d;
+    appendUInt32(d, 8 + tiles.size());
+    appendUInt16(d, width);
+    appendUInt16(d, height);
+    appendUInt32(d, count);
+    d.append(tiles);
+    return d;
+}
+
+void ScreenShareSender::socketError(QAbstractSocket::SocketError e)
+{
+    stop();
+    emit stopped(e);
+}
+
+// ------------------------------------------------------------
+// ScreenShareReceiver
+
+ScreenShareReceiver::ScreenShareReceiver() :
+    QQuickImageProvider(QQuickImageProvider::Image),
+    mSocket(nullptr), mBuddies(nullptr), mHeaderRead(false), mTileSize(0)
+{
+    mServer = new QTcpServer(this);
+    connect(mServer, SIGNAL(newConnection()), this, SLOT(newConnection()));
+}
+
+// Started apart from the constructor, after the first frame
+bool ScreenShareReceiver::listen(const QHostAddress &address, qint16 port)
+{
+    return mServer->listen(address, port);
+}
+
+QImage ScreenShareReceiver::requestImage(const QString &id, QSize *size, const QSize &requestedSize)
+{
+    Q_UNUSED(id);
+
+    QMutexLocker locker(&mFrameLock);
+    QImage image = mFrame;
+    locker.unlock();
+
+    if (size) *size = image.size();
+    if (requestedSize.isValid() && !image.isNull())
+        image = image.scaled(requestedSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    return image;
+}
+
+void ScreenShareReceiver::newConnection()
+{
+    while (mServer->hasPendingConnections())
+    {
+        QTcpSocket *s = mServer->nextPendingConnection();
+
+        // IPv4 senders show up as IPv4-mapped addresses on the dual stack
+        // listener, the buddy list has them as plain IPv4 ones
+        bool ok;
+        quint32 v4 = s->peerAddress().toIPv4Address(&ok);
+        QString ip = ok ? QHostAddress(v4).toString() : s->peerAddress().toString();
+
+        // Already watching another screen, or unknown sender
+        bool known = !mBuddies || QHostAddress(ip).isLoopback() || mBuddies->buddyByIp(ip);
+        if (mSocket || !known) {
+            s->close();
+            s->deleteLater();
+            continue;
+        }
+
+        mSocket = s;
+        mBuffer.clear();
+        mHeaderRead = false;
+        connect(mSocket, SIGNAL(readyRead()), this, SLOT(readData()));
+        connect(mSocket, SIGNAL(disconnected()), this, SLOT(closedConnection()));
+        emit sharingStarted(ip);
+    }
+}
+
+void ScreenShareReceiver::readData()
+{
+    if (!mSocket) return;
+    mBuffer.append(mSocket->readAll());
+
+    // Stream header
+    if (!mHeaderRead)
+    {
+        if (mBuffer.size() < SCREENSHARE_HEADER_SIZE) return;
+        mTileSize = readUInt16(mBuffer.constData() + 5);
+        if (!mBuffer.startsWith(SCREENSHARE_MAGIC) || (mBuffer.at(4) != SCREENSHARE_VERSION) || (mTileSize == 0)) {
+            close();
+            return;
+        }
+        mBuffer.remove(0, SCREENSHARE_HEADER_SIZE);
+        mHeaderRead = true;
+    }
+
+    // Complete frames
+    bool updated = false;
+    while (mBuffer.size() >= 4)
+    {
+        quint32 length = readUInt32(mBuffer.constData());
+        if (length > SCREENSHARE_MAX_FRAME) {
+            close();
+            return;
+        }
+        if ((quint32) mBuffer.size() < 4 + length) break;
+        if (!readFrame(mBuffer.constData() + 4, length)) {
+            close();
+            return;
+        }
+        mBuffer.remove(0, 4 + length);
+        updated = true;
+    }
+
+    if (updated) emit frameUpdated();
+}
+
+// Applies the tiles of a frame to the current image
+bool ScreenShareReceiver::readFrame(const char *data, int size)
+{
+    if (size < 8) return false;
+    int width = readUInt16(data);
+    int height = readUInt16(data + 2);
+    quint32 count = readUInt32(data + 4);
+    int pos = 8;
+    if ((width == 0) || (height == 0) || ((qint64) width * height > SCREENSHARE_MAX_PIXELS)) return false;
+    int columns = (width + mTileSize - 1) / mTileSize;
+    int rows = (height + mTileSize - 1) / mTileSize;
+
+    QMutexLocker locker(&mFrameLock);
+
+    // New sharing or new resolution
+    if ((mFrame.width() != width) || (mFrame.height() != height)) {
+        mFrame = QImage(width, height, QImage::Format_RGB32);
+        if (mFrame.isNull()) return false;
+        mFrame.fill(Qt::black);
+    }
+
+    for (quint32 i = 0; i < count; i++)
+    {
+        if (pos + 8 > size) return false;
+        int column = readUInt16(data + pos);
+        int row = readUInt16(data + pos + 2);
+        quint32 packedSize = readUInt32(data + pos + 4);
+        pos += 8;
+        if ((packedSize > (quint32) (size - pos)) || (column >= columns) || (row >= rows)) return false;
+
+        int x = column * mTileSize;
+        int y = row * mTileSize;
+        int tw = qMin(mTileSize, width - x);
+        int th = qMin(mTileSize, height - y);
+
+        // qUncompress() allocates the size written in the data, it's checked first
+        if ((packedSize < 4) || (readUInt32(data + pos) != (quint32) (tw * th * 4))) return false;
+        QByteArray raw = qUncompress((const uchar*) data + pos, packedSize);
+        if (raw.size() != tw * th * 4) return false;
+        for (int r = 0; r < th; r++)
+            memcpy(mFrame.scanLine(y + r) + x * 4, raw.constData() + r * tw * 4, tw * 4);
+        pos += packedSize;
+    }
+    return true;
+}
+
+void ScreenShareReceiver::closedConnection()
+{
+    close();
+}
+
+// Ends the current sharing, if any
+void ScreenShareReceiver::close()
+{
+    if (!mSocket) return;
+    mSocket->disconnect(this);
+    mSocket->close();
+    mSocket->deleteLater();
+    mSocket = nullptr;
+    mBuffer.clear();
+
+    QMutexLocker locker(&mFrameLock);
+    mFrame = QImage();
+    locker.unlock();
+
+    emit sharingStopped();
+}
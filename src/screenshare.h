@@ -0,0 +1,120 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2011 Emanuele Colombo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef SCREENSHARE_H
+#define SCREENSHARE_H
+
+#include <QObject>
+#include <QQuickImageProvider>
+#include <QtNetwork/QTcpSocket>
+#include <QtNetwork/QTcpServer>
+#include <QByteArray>
+#include <QImage>
+#include <QMutex>
+
+class QTimer;
+class BandwidthShaper;
+class BuddyListItemModel;
+
+// Live screen sharing, on a persistent connection to the TCP port
+// after the one of the avatar web server.
+// The sender captures the screen periodically and splits each frame
+// into tiles: only the tiles that changed since the previous frame are
+// compressed and sent, so the traffic follows what moves on the screen,
+// not its resolution. A new frame is captured only when the previous one
+// has left the socket, slow links get fewer frames instead of a backlog.
+//
+// Stream:
+//  - "DKSS", version (u8), tile size (u16)
+//  - frames: length of the rest (u32), width (u16), height (u16),
+//    tiles (u32), then for each tile column (u16), row (u16),
+//    size (u32) and the tile pixels (RGB32) compressed with qCompress()
+// All the numbers are big endian.
+class ScreenShareSender : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ScreenShareSender(QObject *parent = nullptr);
+    virtual ~ScreenShareSender();
+    void start(QString ip, qint16 port);
+    void stop();
+    inline bool isActive() { return mSocket != nullptr; }
+    inline void setInterval(int ms) { mInterval = ms; }
+    inline void setShaper(BandwidthShaper *shaper) { mShaper = shaper; }
+
+signals:
+    void stopped(int error);
+
+private slots:
+    void connected();
+    void captureFrame();
+    void socketError(QAbstractSocket::SocketError e);
+
+private:
+    QByteArray encodeFrame(const QImage &frame);
+
+    QTcpSocket *mSocket;
+    QTimer *mTimer;
+    QString mIp;
+    int mInterval;                  // ms between two captures
+    BandwidthShaper *mShaper;       // Rate limits, if any
+    QImage mPrevious;               // Last frame sent, to find the changed tiles
+};
+
+// Receives a screen sharing and keeps the frame up to date, served to
+// QML as "image://screenshare/<n>" (n only changes to defeat the cache).
+// One sharing at a time: other connections are refused while it lasts,
+// as are the ones from other hosts that aren't in the buddy list.
+class ScreenShareReceiver : public QObject, public QQuickImageProvider
+{
+    Q_OBJECT
+
+public:
+    ScreenShareReceiver();
+    bool listen(const QHostAddress &address, qint16 port);
+    inline void setBuddies(BuddyListItemModel *buddies) { mBuddies = buddies; }
+    QImage requestImage(const QString &id, QSize *size, const QSize &requestedSize);
+
+public slots:
+    void close();
+
+signals:
+    void sharingStarted(QString senderIp);
+    void frameUpdated();
+    void sharingStopped();
+
+private slots:
+    void newConnection();
+    void readData();
+    void closedConnection();
+
+private:
+    bool readFrame(const char *data, int size);
+
+    QTcpServer *mServer;
+    QTcpSocket *mSocket;
+    BuddyListItemModel *mBuddies;   // Hosts allowed to share their screen
+    QByteArray mBuffer;             // Received data not yet decoded
+    bool mHeaderRead;
+    int mTileSize;
+    QImage mFrame;
+    QMutex mFrameLock;              // QML can ask for the image from its loader thread
+};
+
+#endif // SCREENSHARE_H
@@ -21,6 +21,9 @@
 
 #include <QSettings>
 #include <QDir>
+#include <QUuid>
+#include <QSysInfo>
+#include <QStandardPaths>
 #include "theme.h"
 
 Settings::Settings(QObject *parent) :
@@ -98,3 +101,118 @@ void Settings::saveBuddyName(QString name)
     mSettings.setValue("BuddyName", name);
     mSettings.sync();
 }
+
+qint64 Settings::fanOutBufferBudget()
+{
+    // Memory shared by the destinations of a one-to-many send (16 MB)
+    return mSettings.value("FanOutBufferBudget", 16 * 1048576).toLongLong();
+}
+
+int Settings::bandwidthLimit()
+{
+    // Global limit in KB/s (0 = unlimited)
+    return mSettings.value("Bandwidth/Limit", 0).toInt();
+}
+
+void Settings::saveBandwidthLimit(int kbps)
+{
+    mSettings.setValue("Bandwidth/Limit", kbps);
+    mSettings.sync();
+}
+
+QStringList Settings::peerBandwidthLimits()
+{
+    // Entries in the form "buddy=KBps", the buddy being its instance
+    // ID in hex, or its address for the versions without one
+    return mSettings.value("Bandwidth/PeerLimits").toStringList();
+}
+
+void Settings::savePeerBandwidthLimits(QStringList limits)
+{
+    mSettings.setValue("Bandwidth/PeerLimits", limits);
+    mSettings.sync();
+}
+
+QStringList Settings::bandwidthSchedule()
+{
+    // Entries in the form "HH:MM-HH:MM=KBps"
+    return mSettings.value("Bandwidth/Schedule").toStringList();
+}
+
+void Settings::saveBandwidthSchedule(QStringList entries)
+{
+    mSettings.setValue("Bandwidth/Schedule", entries);
+    mSettings.sync();
+}
+
+int Settings::peerExpiryHeartbeats()
+{
+    // Heartbeats a buddy can miss before being probed and removed
+    return mSettings.value("PeerExpiryHeartbeats", 3).toInt();
+}
+
+bool Settings::legacyBroadcast()
+{
+    // Discovery also by broadcast, needed by the versions without multicast
+    return mSettings.value("Discovery/LegacyBroadcast", true).toBool();
+}
+
+QVariantList Settings::peerCache()
+{
+    // Buddies seen in the previous sessions
+    return mSettings.value("Discovery/PeerCache").toList();
+}
+
+void Settings::savePeerCache(QVariantList peers)
+{
+    mSettings.setValue("Discovery/PeerCache", peers);
+    mSettings.sync();
+}
+
+QByteArray Settings::instanceId()
+{
+    // Identifies this installation in the hello messages, created once.
+    // It's bound to the machine: settings copied to another one (cloned
+    // lab or VDI images) get a new ID there, or both hosts would look
+    // like the same buddy.
+    QString machine = QString(QSysInfo::machineUniqueId().toHex()) + "/" + Platform::getHostname();
+    QByteArray id = mSettings.value("Discovery/InstanceId").toByteArray();
+    QString owner = mSettings.value("Discovery/InstanceMachine").toString();
+    if ((id.size() != 16) || (!owner.isEmpty() && (owner != machine))) {
+        id = QUuid::createUuid().toRfc4122();
+        mSettings.setValue("Discovery/InstanceId", id);
+    }
+    if (owner != machine) {
+        mSettings.setValue("Discovery/InstanceMachine", machine);
+        mSettings.sync();
+    }
+    return id;
+}
+
+QString Settings::screenshotFormat()
+{
+    // "jpg" or, for lossless screenshots, "png"
+    QString format = mSettings.value("Screenshot/Format", "jpg").toString().toLower();
+    return (format == "png") ? format : "jpg";
+}
+
+int Settings::screenshotQuality()
+{
+    // JPEG quality (0-100), PNG compression is lossless
+    return qBound(0, mSettings.value("Screenshot/Quality", 95).toInt(), 100);
+}
+
+int Settings::screenShareInterval()
+{
+    // ms between two frames of a screen sharing
+    return qMax(mSettings.value("ScreenShare/Interval", 500).toInt(), 50);
+}
+
+QString Settings::telemetryLogPath()
+{
+    // JSON lines with the timings of every transfer, empty when disabled.
+    // Opt-in, the entries carry the addresses of the buddies; the
+    // transferTelemetry() signal is there anyway.
+    if (!mSettings.value("Telemetry/Log", false).toBool()) return "";
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/telemetry.jsonl";
+}
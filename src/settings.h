@@ -21,6 +21,8 @@
 
 #include <QObject>
 #include <QSettings>
+#include <QStringList>
+#include <QVariantList>
 
 class Settings : public QObject
 {
@@ -37,6 +39,22 @@ public:
     bool showTermsOnStart();
     QString buddyName();
     void saveBuddyName(QString name);
+    qint64 fanOutBufferBudget();
+    int bandwidthLimit();
+    void saveBandwidthLimit(int kbps);
+    QStringList peerBandwidthLimits();
+    void savePeerBandwidthLimits(QStringList limits);
+    QStringList bandwidthSchedule();
+    void saveBandwidthSchedule(QStringList entries);
+    int peerExpiryHeartbeats();
+    bool legacyBroadcast();
+    QVariantList peerCache();
+    void savePeerCache(QVariantList peers);
+    QByteArray instanceId();
+    QString screenshotFormat();
+    int screenshotQuality();
+    int screenShareInterval();
+    QString telemetryLogPath();
 
 signals:
 
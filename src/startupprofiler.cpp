@@ -0,0 +1,67 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2011 Emanuele Colombo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "startupprofiler.h"
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QPair>
+#include <QByteArray>
+#include <QTextStream>
+
+#include <stdlib.h>
+
+static QElapsedTimer startupClock;
+static QList<QPair<QByteArray, qint64> > startupPhases;   // Name, ns from start()
+static bool benchmarkMode = false;
+static bool profiling = false;
+
+void StartupProfiler::start(bool isBenchmark)
+{
+    benchmarkMode = isBenchmark;
+    profiling = benchmarkMode || (getenv("DUKTO_STARTUP_PROFILE") != nullptr);
+    startupClock.start();
+}
+
+// Ends the phase that started at the previous mark
+void StartupProfiler::mark(const char *phase)
+{
+    if (!profiling) return;
+    startupPhases.append(qMakePair(QByteArray(phase), startupClock.nsecsElapsed()));
+}
+
+bool StartupProfiler::isBenchmark()
+{
+    return benchmarkMode;
+}
+
+void StartupProfiler::report()
+{
+    if (!profiling) return;
+
+    QTextStream out(stdout);
+    qint64 previous = 0;
+    for (int i = 0; i < startupPhases.size(); i++)
+    {
+        const QPair<QByteArray, qint64> &p = startupPhases.at(i);
+        out << QString(p.first).leftJustified(20) << QString::number((p.second - previous) / 1000000.0, 'f', 1).rightJustified(8)
+            << " ms  (at " << QString::number(p.second / 1000000.0, 'f', 1) << " ms)" << Qt::endl;
+        previous = p.second;
+    }
+    startupPhases.clear();
+}
@@ -0,0 +1,39 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2011 Emanuele Colombo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef STARTUPPROFILER_H
+#define STARTUPPROFILER_H
+
+#include <qglobal.h>
+
+// Timestamps of the startup phases, from main() to the first frame
+// and the initialization deferred after it. Printed when DUKTO_STARTUP_PROFILE
+// is set; "dukto --benchmark-startup" prints them and quits right after.
+class StartupProfiler
+{
+public:
+    static void start(bool benchmark);
+    static void mark(const char *phase);
+    static void report();
+    static bool isBenchmark();
+
+private:
+    StartupProfiler() {}
+};
+
+#endif // STARTUPPROFILER_H
@@ -0,0 +1,127 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2011 Emanuele Colombo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "tracer.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMutex>
+#include <QThread>
+
+#include <stdlib.h>
+
+// Events are buffered and written in blocks of this size
+#define TRACE_FLUSH_SIZE (256 * 1024)
+
+bool Tracer::mEnabled = false;
+
+static QElapsedTimer traceClock;
+static QFile *traceFile = nullptr;
+static QByteArray traceBuffer;
+static QMutex traceMutex;           // Screenshots are encoded in a worker thread
+static bool traceFirstEvent = true;
+
+static void stopTracer()
+{
+    Tracer::stop();
+}
+
+void Tracer::start()
+{
+    QByteArray path = qgetenv("DUKTO_TRACE");
+    if (path.isEmpty() || mEnabled) return;
+
+    traceFile = new QFile(QString::fromLocal8Bit(path));
+    if (!traceFile->open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        delete traceFile;
+        traceFile = nullptr;
+        return;
+    }
+    traceFile->write("[\n");
+    traceClock.start();
+    mEnabled = true;
+
+    // Every mode returns from main(), the file is completed there
+    atexit(stopTracer);
+}
+
+void Tracer::stop()
+{
+    if (!mEnabled) return;
+    QMutexLocker locker(&traceMutex);
+    mEnabled = false;
+    traceBuffer.append("\n]\n");
+    traceFile->write(traceBuffer);
+    traceFile->close();
+    delete traceFile;
+    traceFile = nullptr;
+    traceBuffer.clear();
+}
+
+qint64 Tracer::now()
+{
+    return traceClock.nsecsElapsed();
+}
+
+// Appends an event with the fields common to all the phases; the
+// timestamps of the format are in microseconds
+static void appendEvent(const char *phase, const char *category, const char *name, qint64 startNs,
+                        qint64 durationNs, const char *argName, qint64 arg)
+{
+    QMutexLocker locker(&traceMutex);
+    if (!traceFile) return;
+
+    if (!traceFirstEvent) traceBuffer.append(",\n");
+    traceFirstEvent = false;
+    traceBuffer.append("{\"name\":\"").append(name);
+    if (category) traceBuffer.append("\",\"cat\":\"").append(category);
+    traceBuffer.append("\",\"ph\":\"").append(phase);
+    traceBuffer.append("\",\"ts\":").append(QByteArray::number(startNs / 1000.0, 'f', 3));
+    if (durationNs >= 0) traceBuffer.append(",\"dur\":").append(QByteArray::number(durationNs / 1000.0, 'f', 3));
+    if (phase[0] == 'i') traceBuffer.append(",\"s\":\"t\"");
+    traceBuffer.append(",\"pid\":").append(QByteArray::number(QCoreApplication::applicationPid()));
+    traceBuffer.append(",\"tid\":").append(QByteArray::number((quint64) (quintptr) QThread::currentThreadId()));
+    if (argName) traceBuffer.append(",\"args\":{\"").append(argName).append("\":").append(QByteArray::number(arg)).append('}');
+    traceBuffer.append('}');
+
+    if (traceBuffer.size() >= TRACE_FLUSH_SIZE) {
+        traceFile->write(traceBuffer);
+        traceBuffer.clear();
+    }
+}
+
+void Tracer::complete(const char *category, const char *name, qint64 startNs, qint64 durationNs,
+                      const char *argName, qint64 arg)
+{
+    if (!mEnabled) return;
+    appendEvent("X", category, name, startNs, durationNs, argName, arg);
+}
+
+void Tracer::instant(const char *category, const char *name, const char *argName, qint64 arg)
+{
+    if (!mEnabled) return;
+    appendEvent("i", category, name, now(), -1, argName, arg);
+}
+
+// Counter track, drawn by the viewers as a chart
+void Tracer::counter(const char *name, const char *series, qint64 value)
+{
+    if (!mEnabled) return;
+    appendEvent("C", nullptr, name, now(), -1, series, value);
+}
@@ -0,0 +1,66 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2011 Emanuele Colombo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <qglobal.h>
+
+// Timeline of the protocol and UI events in the Chrome Trace Event
+// format, to be opened with chrome://tracing or ui.perfetto.dev.
+// Enabled by setting DUKTO_TRACE to the output file; when it's not set
+// every trace point costs a single test of a boolean.
+class Tracer
+{
+public:
+    static void start();
+    static void stop();
+    static inline bool isEnabled() { return mEnabled; }
+    static qint64 now();
+    static void complete(const char *category, const char *name, qint64 startNs, qint64 durationNs,
+                         const char *argName = nullptr, qint64 arg = 0);
+    static void instant(const char *category, const char *name, const char *argName = nullptr, qint64 arg = 0);
+    static void counter(const char *name, const char *series, qint64 value);
+
+private:
+    Tracer() {}
+    static bool mEnabled;
+};
+
+// Records the enclosing block as a span. Names must be string literals,
+// they're written as they are.
+class TraceSpan
+{
+public:
+    inline TraceSpan(const char *category, const char *name) :
+        mCategory(category), mName(name), mArgName(nullptr), mArg(0),
+        mStart(Tracer::isEnabled() ? Tracer::now() : -1) {}
+    inline ~TraceSpan() {
+        if (mStart >= 0) Tracer::complete(mCategory, mName, mStart, Tracer::now() - mStart, mArgName, mArg);
+    }
+    inline void setArg(const char *name, qint64 value) { mArgName = name; mArg = value; }
+
+private:
+    const char *mCategory;
+    const char *mName;
+    const char *mArgName;
+    qint64 mArg;
+    qint64 mStart;                  // -1 when tracing is off
+};
+
+#endif // TRACER_H
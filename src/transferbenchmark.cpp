@@ -0,0 +1,369 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2011 Emanuele Colombo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "transferbenchmark.h"
+
+#include <QTextStream>
+#include <QFile>
+#include <QDir>
+#include <QFileInfo>
+#include <QTemporaryDir>
+#include <QTimer>
+#include <QRandomGenerator>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#if defined(Q_OS_UNIX)
+#include <sys/resource.h>
+#endif
+
+#define DEFAULT_RUNS 3
+#define DEFAULT_FRAMINGS "v1,v2"
+#define DEFAULT_HUGE_SIZE 512           // MB
+#define DEFAULT_SMALL_FILES 10000
+#define DEFAULT_TREE_DEPTH 64
+#define DEFAULT_TEXT_SIZE 8             // MB
+#define DEFAULT_PORT 14744
+#define SMALL_FILE_SIZE 4096
+#define TREE_FILES_PER_LEVEL 16
+#define PATTERN_SIZE 65536
+
+TransferBenchmark::TransferBenchmark(QObject *parent) :
+    QObject(parent), mDir(nullptr),
+    mRuns(DEFAULT_RUNS), mHugeSize(DEFAULT_HUGE_SIZE * 1048576LL), mSmallFiles(DEFAULT_SMALL_FILES),
+    mTreeDepth(DEFAULT_TREE_DEPTH), mTextSize(DEFAULT_TEXT_SIZE * 1048576LL), mPort(DEFAULT_PORT),
+    mWorkload(0), mFraming(0), mRun(0), mSent(false), mReceived(false), mReceivedBytes(0)
+{
+    mWorkloadNames << "huge" << "small" << "tree" << "text";
+    mFramings = QString(DEFAULT_FRAMINGS).split(',');
+
+    connect(&mSender, SIGNAL(sendFileComplete(QStringList*)), this, SLOT(sendFileComplete(QStringList*)));
+    connect(&mSender, SIGNAL(sendFileError(int)), this, SLOT(sendFileError(int)));
+    connect(&mReceiver, SIGNAL(receiveFileComplete(QStringList*,qint64)), this, SLOT(receiveFileComplete(QStringList*,qint64)));
+    connect(&mReceiver, SIGNAL(receiveTextComplete(QString*,qint64)), this, SLOT(receiveTextComplete(QString*,qint64)));
+    connect(&mReceiver, SIGNAL(receiveFileCancelled()), this, SLOT(receiveFileCancelled()));
+}
+
+TransferBenchmark::~TransferBenchmark()
+{
+    delete mDir;
+}
+
+// Options: --workloads=huge,small,tree,text --framing=v1,v2 --runs=N
+//          --size=MB --files=N --depth=N --text-size=MB --port=P --dir=PATH
+bool TransferBenchmark::configure(const QStringList &args)
+{
+    QTextStream err(stderr);
+    foreach (const QString &arg, args.mid(1))
+    {
+        if (arg == "--benchmark-transfer") continue;
+        QString name = arg.section('=', 0, 0);
+        QString text = arg.section('=', 1);
+        bool ok = false;
+        int value = text.toInt(&ok);
+        if (!ok || (value <= 0)) value = 0;
+
+        if (name == "--workloads") mWorkloadNames = text.split(',', Qt::SkipEmptyParts);
+        else if (name == "--framing") mFramings = text.split(',', Qt::SkipEmptyParts);
+        else if (name == "--dir") mBaseDir = text;
+        else if ((name == "--runs") && value) mRuns = value;
+        else if ((name == "--size") && value) mHugeSize = value * 1048576LL;
+        else if ((name == "--files") && value) mSmallFiles = value;
+        else if ((name == "--depth") && value) mTreeDepth = value;
+        else if ((name == "--text-size") && value) mTextSize = value * 1048576LL;
+        else if ((name == "--port") && value) mPort = value;
+        else
+        {
+            err << "Unknown or malformed option: " << arg << Qt::endl
+                << "Usage: dukto --benchmark-transfer [--workloads=huge,small,tree,text] [--framing=v1,v2]" << Qt::endl
+                << "       [--runs=N] [--size=MB] [--files=N] [--depth=N] [--text-size=MB] [--port=P] [--dir=PATH]" << Qt::endl;
+            return false;
+        }
+    }
+
+    foreach (const QString &framing, mFramings)
+    {
+        if ((framing != "v1") && (framing != "v2")) {
+            err << "Unknown framing: " << framing << Qt::endl;
+            return false;
+        }
+    }
+    if (mFramings.isEmpty()) return false;
+
+    foreach (const QString &name, mWorkloadNames)
+    {
+        if ((name != "huge") && (name != "small") && (name != "tree") && (name != "text")) {
+            err << "Unknown workload: " << name << Qt::endl;
+            return false;
+        }
+        Workload w;
+        w.name = name;
+        w.bytes = 0;
+        w.files = 0;
+        mWorkloads.append(w);
+    }
+    return !mWorkloads.isEmpty();
+}
+
+void TransferBenchmark::start()
+{
+    mDir = mBaseDir.isEmpty() ? new QTemporaryDir() : new QTemporaryDir(mBaseDir + "/dukto-benchmark-XXXXXX");
+    if (!mDir->isValid()) {
+        fail("Cannot create the working folder");
+        return;
+    }
+
+    // Incompressible content, a pattern repeated in every file
+    mPattern.resize(PATTERN_SIZE);
+    QRandomGenerator rng(4644);
+    for (int i = 0; i < PATTERN_SIZE; i++)
+        mPattern[i] = (char) rng.bounded(256);
+
+    // The receiver saves in the current folder
+    QDir(mDir->path()).mkpath("received");
+    QDir::setCurrent(mDir->path() + "/received");
+
+    // Only the receiver needs to listen, on a loopback port of its own;
+    // without discovery, nothing of the benchmark reaches the LAN
+    mReceiver.setPorts(mPort, mPort);
+    mReceiver.initialize(false);
+
+    QTimer::singleShot(0, this, SLOT(nextRun()));
+}
+
+bool TransferBenchmark::writeFile(const QString &path, qint64 size)
+{
+    QFile f(path);
+    if (!f.open(QIODevice::WriteOnly)) return false;
+    while (size > 0)
+    {
+        qint64 chunk = qMin(size, (qint64) mPattern.size());
+        if (f.write(mPattern.constData(), chunk) != chunk) return false;
+        size -= chunk;
+    }
+    return true;
+}
+
+// Creates the data of a workload, outside of the measured time
+bool TransferBenchmark::prepare(Workload &w)
+{
+    QString base = mDir->path() + "/source";
+    QDir(base).removeRecursively();
+    QDir().mkpath(base);
+
+    if (w.name == "huge")
+    {
+        w.paths << base + "/huge.bin";
+        w.files = 1;
+        w.bytes = mHugeSize;
+        return writeFile(w.paths.first(), mHugeSize);
+    }
+    else if (w.name == "small")
+    {
+        QString folder = base + "/small";
+        QDir().mkpath(folder);
+        for (int i = 0; i < mSmallFiles; i++)
+            if (!writeFile(folder + QString("/file%1.bin").arg(i), SMALL_FILE_SIZE)) return false;
+        w.paths << folder;
+        w.files = mSmallFiles;
+        w.bytes = (qint64) mSmallFiles * SMALL_FILE_SIZE;
+        return true;
+    }
+    else if (w.name == "tree")
+    {
+        QString folder = base + "/tree";
+        for (int level = 0; level < mTreeDepth; level++)
+        {
+            folder += QString("/level%1").arg(level);
+            QDir().mkpath(folder);
+            for (int i = 0; i < TREE_FILES_PER_LEVEL; i++)
+                if (!writeFile(folder + QString("/file%1.bin").arg(i), SMALL_FILE_SIZE)) return false;
+        }
+        w.paths << base + "/tree";
+        w.files = mTreeDepth * TREE_FILES_PER_LEVEL;
+        w.bytes = (qint64) w.files * SMALL_FILE_SIZE;
+        return true;
+    }
+
+    // Text: printable, a line every 80 characters
+    w.text.reserve(mTextSize);
+    while (w.text.size() < mTextSize)
+        w.text.append(QString("%1 The quick brown fox jumps over the lazy dog, again and again and again.\n")
+                      .arg(w.text.size(), 8, 10, QChar('0')).left(80));
+    w.text.truncate(mTextSize);
+    w.files = 1;
+    w.bytes = w.text.toUtf8().size();
+    return true;
+}
+
+void TransferBenchmark::nextRun()
+{
+    if (mRun >= mRuns) {
+        mFraming++;
+        mRun = 0;
+    }
+    if (mFraming >= mFramings.size()) {
+        mWorkloads[mWorkload].text.clear();
+        mWorkload++;
+        mFraming = 0;
+    }
+    if (mWorkload >= mWorkloads.size()) {
+        emit finished(0);
+        return;
+    }
+
+    Workload &w = mWorkloads[mWorkload];
+    if ((mRun == 0) && (mFraming == 0) && !prepare(w)) {
+        fail("Cannot create the data of the " + w.name + " workload");
+        return;
+    }
+
+    // Nothing left from the previous run, or the receiver would rename
+    QDir received(mDir->path() + "/received");
+    foreach (const QString &entry, received.entryList(QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden))
+    {
+        QFileInfo fi(received.filePath(entry));
+        if (fi.isDir())
+            QDir(fi.filePath()).removeRecursively();
+        else
+            received.remove(entry);
+    }
+
+    // The sender learns the receiver's capabilities from its hello, there's
+    // no discovery here: the entry is made up, v1 is a buddy without any
+    QHostAddress receiver(QHostAddress::LocalHost);
+    quint32 caps = (mFramings.at(mFraming) == "v2") ? DuktoProtocol::localCapabilities() : 0;
+    mSender.getPeers().insert(receiver, Peer(receiver, "benchmark", mPort, caps));
+
+    mSent = false;
+    mReceived = false;
+    mReceivedBytes = 0;
+    mUsageStart = currentUsage();
+    mClock.start();
+    if (w.name == "text")
+        mSender.sendText("127.0.0.1", mPort, w.text);
+    else
+        mSender.sendFile("127.0.0.1", mPort, w.paths);
+}
+
+void TransferBenchmark::sendFileComplete(QStringList *files)
+{
+    Q_UNUSED(files);
+    mSent = true;
+    if (mReceived) runFinished();
+}
+
+void TransferBenchmark::receiveFileComplete(QStringList *files, qint64 totalSize)
+{
+    Q_UNUSED(files);
+    mReceived = true;
+    mReceivedBytes = totalSize;
+    if (mSent) runFinished();
+}
+
+void TransferBenchmark::receiveTextComplete(QString *text, qint64 totalSize)
+{
+    Q_UNUSED(text);
+    mReceived = true;
+    mReceivedBytes = totalSize;
+    if (mSent) runFinished();
+}
+
+void TransferBenchmark::sendFileError(int code)
+{
+    fail("Send error, code " + QString::number(code));
+}
+
+void TransferBenchmark::receiveFileCancelled()
+{
+    fail("Receive cancelled");
+}
+
+void TransferBenchmark::runFinished()
+{
+    double seconds = mClock.nsecsElapsed() / 1e9;
+    Usage end = currentUsage();
+    const Workload &w = mWorkloads.at(mWorkload);
+
+    QJsonObject r;
+    r["workload"] = w.name;
+    r["framing"] = mFramings.at(mFraming);
+    r["run"] = mRun + 1;
+    r["ok"] = (mReceivedBytes == w.bytes);
+    r["files"] = w.files;
+    r["bytes"] = (double) w.bytes;
+    r["seconds"] = seconds;
+    r["mb_per_s"] = w.bytes / 1048576.0 / seconds;
+    r["files_per_s"] = w.files / seconds;
+    r["cpu_user_s"] = (end.userUs - mUsageStart.userUs) / 1e6;
+    r["cpu_system_s"] = (end.systemUs - mUsageStart.systemUs) / 1e6;
+    r["read_syscalls"] = (end.readCalls < 0) ? QJsonValue() : QJsonValue((double) (end.readCalls - mUsageStart.readCalls));
+    r["write_syscalls"] = (end.writeCalls < 0) ? QJsonValue() : QJsonValue((double) (end.writeCalls - mUsageStart.writeCalls));
+    r["peak_rss_bytes"] = (double) end.peakRss;
+    r["qt_version"] = QString(qVersion());
+    QTextStream(stdout) << QJsonDocument(r).toJson(QJsonDocument::Compact) << Qt::endl;
+
+    mRun++;
+    QTimer::singleShot(0, this, SLOT(nextRun()));
+}
+
+void TransferBenchmark::fail(const QString &message)
+{
+    QTextStream(stderr) << message << Qt::endl;
+    emit finished(1);
+}
+
+// CPU time and peak RSS of the process; syscall counts from
+// /proc/self/io (Linux only)
+TransferBenchmark::Usage TransferBenchmark::currentUsage()
+{
+    Usage u;
+    u.userUs = 0;
+    u.systemUs = 0;
+    u.readCalls = -1;
+    u.writeCalls = -1;
+    u.peakRss = 0;
+
+#if defined(Q_OS_UNIX)
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == 0)
+    {
+        u.userUs = ru.ru_utime.tv_sec * 1000000LL + ru.ru_utime.tv_usec;
+        u.systemUs = ru.ru_stime.tv_sec * 1000000LL + ru.ru_stime.tv_usec;
+#if defined(Q_OS_MAC)
+        u.peakRss = ru.ru_maxrss;
+#else
+        u.peakRss = ru.ru_maxrss * 1024LL;
+#endif
+    }
+#endif
+
+#if defined(Q_OS_LINUX)
+    QFile io("/proc/self/io");
+    if (io.open(QIODevice::ReadOnly))
+    {
+        foreach (const QByteArray &line, io.readAll().split('\n'))
+        {
+            if (line.startsWith("syscr:")) u.readCalls = line.mid(6).trimmed().toLongLong();
+            else if (line.startsWith("syscw:")) u.writeCalls = line.mid(6).trimmed().toLongLong();
+        }
+    }
+#endif
+
+    return u;
+}
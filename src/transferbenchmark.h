@@ -0,0 +1,111 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2011 Emanuele Colombo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef TRANSFERBENCHMARK_H
+#define TRANSFERBENCHMARK_H
+
+#include <QObject>
+#include <QList>
+#include <QStringList>
+#include <QElapsedTimer>
+
+#include "duktoprotocol.h"
+
+class QTemporaryDir;
+
+// Throughput benchmark of the transfer path (dukto --benchmark-transfer).
+// A sender and a receiver DuktoProtocol run in the same process and
+// move a set of workloads over loopback: one huge file, many 4 KB
+// files, a deep folder tree and a large text snippet, both with the v1
+// stream and with the v2 framing. Every run prints
+// a JSON object on a line of its own: MB/s, files/s, CPU time, read and
+// write syscalls and peak RSS, so results can be compared across
+// patches and Qt versions. CPU time is the one of both ends together.
+class TransferBenchmark : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit TransferBenchmark(QObject *parent = nullptr);
+    virtual ~TransferBenchmark();
+    bool configure(const QStringList &args);
+    void start();
+
+signals:
+    void finished(int code);
+
+private slots:
+    void nextRun();
+    void sendFileComplete(QStringList *files);
+    void sendFileError(int code);
+    void receiveFileComplete(QStringList *files, qint64 totalSize);
+    void receiveTextComplete(QString *text, qint64 totalSize);
+    void receiveFileCancelled();
+
+private:
+    struct Workload {
+        QString name;
+        QStringList paths;          // Elements to send
+        QString text;               // Text to send, for the text workload
+        qint64 bytes;
+        int files;
+    };
+
+    struct Usage {
+        qint64 userUs;
+        qint64 systemUs;
+        qint64 readCalls;           // -1 if unknown
+        qint64 writeCalls;          // -1 if unknown
+        qint64 peakRss;             // Bytes, 0 if unknown
+    };
+
+    bool prepare(Workload &w);
+    bool writeFile(const QString &path, qint64 size);
+    void runFinished();
+    void fail(const QString &message);
+    static Usage currentUsage();
+
+    DuktoProtocol mSender;
+    DuktoProtocol mReceiver;
+    QTemporaryDir *mDir;
+    QByteArray mPattern;            // Content of the generated files
+    QElapsedTimer mClock;
+    Usage mUsageStart;
+
+    // Configuration
+    QStringList mWorkloadNames;
+    QStringList mFramings;          // "v1" and/or "v2"
+    int mRuns;
+    qint64 mHugeSize;               // Bytes
+    int mSmallFiles;
+    int mTreeDepth;
+    qint64 mTextSize;               // Bytes
+    qint16 mPort;
+    QString mBaseDir;
+
+    // Progress
+    QList<Workload> mWorkloads;
+    int mWorkload;
+    int mFraming;                   // Index in mFramings
+    int mRun;
+    bool mSent;
+    bool mReceived;
+    qint64 mReceivedBytes;
+};
+
+#endif // TRANSFERBENCHMARK_H
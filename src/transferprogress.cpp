@@ -0,0 +1,109 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2011 Emanuele Colombo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "transferprogress.h"
+
+#define PROGRESS_INTERVAL 100
+// Weight of the last sample in the throughput average
+#define PROGRESS_SPEED_WEIGHT 0.2
+// The timer stops after this many ticks without data
+#define PROGRESS_IDLE_TICKS 20
+
+TransferProgress::TransferProgress(QObject *parent) :
+    QObject(parent), mTotal(0), mPartial(0), mSampledPartial(0), mSampledAt(0),
+    mSpeed(-1), mPublishedPartial(-1), mIdleTicks(0)
+{
+    mTimer.setInterval(PROGRESS_INTERVAL);
+    connect(&mTimer, SIGNAL(timeout()), this, SLOT(tick()));
+    mClock.start();
+}
+
+// A new transfer: start sampling from scratch
+void TransferProgress::reset()
+{
+    mTimer.stop();
+    mTotal = 0;
+    mPartial = 0;
+    mSampledPartial = 0;
+    mSampledAt = mClock.elapsed();
+    mSpeed = -1;
+    mPublishedPartial = -1;
+    mIdleTicks = 0;
+}
+
+void TransferProgress::update(qint64 total, qint64 partial)
+{
+    // A counter going backwards can only be a new transfer
+    if (partial < mPartial) reset();
+    mTotal = total;
+
+    // First update of the transfer
+    if (mPublishedPartial < 0)
+    {
+        mPartial = partial;
+        mSampledPartial = partial;
+        mSampledAt = mClock.elapsed();
+        mTimer.start();
+        publish();
+        if (mPartial >= mTotal) mTimer.stop();
+        return;
+    }
+
+    // Data again after a pause: sampling starts over, the average is kept
+    if (!mTimer.isActive() && (partial < total))
+    {
+        mSampledPartial = mPartial;
+        mSampledAt = mClock.elapsed();
+        mIdleTicks = 0;
+        mTimer.start();
+    }
+
+    mPartial = partial;
+    if (mPartial >= mTotal)
+    {
+        mTimer.stop();
+        publish();
+    }
+}
+
+void TransferProgress::tick()
+{
+    qint64 now = mClock.elapsed();
+    if (now <= mSampledAt) return;
+
+    double sample = (mPartial - mSampledPartial) * 1000.0 / (now - mSampledAt);
+    mSpeed = (mSpeed < 0) ? sample : (PROGRESS_SPEED_WEIGHT * sample + (1 - PROGRESS_SPEED_WEIGHT) * mSpeed);
+    mIdleTicks = (mPartial == mSampledPartial) ? mIdleTicks + 1 : 0;
+    mSampledPartial = mPartial;
+    mSampledAt = now;
+
+    publish();
+    if (mIdleTicks >= PROGRESS_IDLE_TICKS) mTimer.stop();
+}
+
+void TransferProgress::publish()
+{
+    int secondsLeft = -1;
+    if (mSpeed > 0) secondsLeft = (int) ((mTotal - mPartial) / mSpeed + 0.5);
+    if (mPartial >= mTotal) secondsLeft = 0;
+
+    // Nothing new and the estimate can't change much, no need to bother anyone
+    if ((mPartial == mPublishedPartial) && (mIdleTicks == 0)) return;
+    mPublishedPartial = mPartial;
+    emit progress(mTotal, mPartial, (mSpeed > 0) ? (qint64) mSpeed : 0, secondsLeft);
+}
@@ -0,0 +1,63 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2011 Emanuele Colombo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef TRANSFERPROGRESS_H
+#define TRANSFERPROGRESS_H
+
+#include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+
+// Coalesces the progress of a transfer: update() is called for every
+// chunk and only stores the counters, progress() is emitted at most
+// ten times per second, with a smoothed throughput and the time left.
+// The first and the last update of a transfer are emitted right away.
+// reset() marks the start of a new transfer; the total can grow while
+// the transfer goes on (e.g. framing overhead) without restarting it.
+class TransferProgress : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit TransferProgress(QObject *parent = nullptr);
+
+public slots:
+    void reset();
+    void update(qint64 total, qint64 partial);
+
+signals:
+    void progress(qint64 total, qint64 partial, qint64 bytesPerSecond, int secondsLeft);
+
+private slots:
+    void tick();
+
+private:
+    void publish();
+
+    QTimer mTimer;
+    QElapsedTimer mClock;
+    qint64 mTotal;
+    qint64 mPartial;
+    qint64 mSampledPartial;     // Counter at the last tick
+    qint64 mSampledAt;          // ms, mClock time of the last tick
+    double mSpeed;              // Exponentially weighted bytes per second, -1 if unknown
+    qint64 mPublishedPartial;   // Counter of the last progress() emitted
+    int mIdleTicks;             // Ticks without any new data
+};
+
+#endif // TRANSFERPROGRESS_H
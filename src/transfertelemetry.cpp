@@ -0,0 +1,129 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2011 Emanuele Colombo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "transfertelemetry.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QJsonDocument>
+
+// The log is rotated once it's this big, keeping one previous file
+#define TELEMETRY_LOG_MAX_SIZE (1024 * 1024)
+
+TransferTelemetry::TransferTelemetry() :
+    mActive(false), mSending(false), mV2(false),
+    mDurationNs(0), mConnectNs(-1), mSocketWaitNs(0), mDiskNs(0), mThrottleNs(0), mBusyNs(0),
+    mWriteMark(-1), mThrottleMark(-1), mChunks(0), mElements(0)
+{
+    for (int i = 0; i < SectionCount; i++) mBytes[i] = 0;
+}
+
+void TransferTelemetry::begin(bool sending, const QString &peer)
+{
+    *this = TransferTelemetry();
+    mActive = true;
+    mSending = sending;
+    mPeer = peer;
+    mStarted = QDateTime::currentDateTimeUtc();
+    mClock.start();
+}
+
+void TransferTelemetry::connected(bool v2)
+{
+    if (!mActive || (mConnectNs >= 0)) return;
+    mConnectNs = clock();
+    mV2 = v2;
+}
+
+// All the data handed to the socket has been written
+void TransferTelemetry::drained()
+{
+    if (mWriteMark < 0) return;
+    mSocketWaitNs += clock() - mWriteMark;
+    mWriteMark = -1;
+}
+
+void TransferTelemetry::throttled()
+{
+    if (mThrottleMark < 0) mThrottleMark = clock();
+}
+
+void TransferTelemetry::resumed()
+{
+    if (mThrottleMark < 0) return;
+    mThrottleNs += clock() - mThrottleMark;
+    mThrottleMark = -1;
+}
+
+void TransferTelemetry::finish(const QString &result)
+{
+    if (!mActive) return;
+    resumed();
+    mActive = false;
+    mResult = result;
+    mDurationNs = clock();
+    if (mConnectNs < 0) mConnectNs = mDurationNs;
+
+    // The receiver waits for the network whenever it's not busy
+    if (!mSending)
+        mSocketWaitNs = qMax((qint64) 0, mDurationNs - mConnectNs - mBusyNs - mThrottleNs);
+}
+
+QJsonObject TransferTelemetry::toJson() const
+{
+    static const char *sections[SectionCount] = { "preamble", "filename", "filesize", "data", "framing" };
+
+    QJsonObject bytes;
+    qint64 total = 0;
+    for (int i = 0; i < SectionCount; i++) {
+        bytes[sections[i]] = (double) mBytes[i];
+        total += mBytes[i];
+    }
+
+    QJsonObject r;
+    r["direction"] = mSending ? "send" : "receive";
+    r["peer"] = mPeer;
+    r["started"] = mStarted.toString(Qt::ISODate);
+    r["result"] = mResult;
+    r["v2"] = mV2;
+    r["duration_ms"] = mDurationNs / 1e6;
+    r["connect_ms"] = mConnectNs / 1e6;
+    r["socket_wait_ms"] = mSocketWaitNs / 1e6;
+    r["disk_ms"] = mDiskNs / 1e6;
+    r["throttle_ms"] = mThrottleNs / 1e6;
+    r["bytes"] = bytes;
+    r["total_bytes"] = (double) total;
+    r["chunks"] = (double) mChunks;
+    r["elements"] = (double) mElements;
+    return r;
+}
+
+void TransferTelemetry::appendToLog(const QString &path, const QJsonObject &record)
+{
+    QFileInfo fi(path);
+    QDir().mkpath(fi.absolutePath());
+    if (fi.size() > TELEMETRY_LOG_MAX_SIZE) {
+        QFile::remove(path + ".1");
+        QFile::rename(path, path + ".1");
+    }
+
+    QFile f(path);
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Append)) return;
+    f.write(QJsonDocument(record).toJson(QJsonDocument::Compact) + "\n");
+}
@@ -0,0 +1,88 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2011 Emanuele Colombo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef TRANSFERTELEMETRY_H
+#define TRANSFERTELEMETRY_H
+
+#include <QString>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QJsonObject>
+
+// Timing counters of a send or receive session, to tell whether a slow
+// transfer waited on the network, on the disk or on the rate limiter.
+// DuktoProtocol fills one for every session and emits it when the
+// session ends; it can also be appended as a JSON line to a log file.
+//  - connect: sender, connection and v2 handshake; receiver, accept
+//    to the end of the preamble
+//  - socket wait: sender, data written and not yet drained by the
+//    socket; receiver, time spent waiting for data to arrive
+//  - disk: file reads (sender) or writes (receiver)
+//  - throttle: waiting for the bandwidth limits
+class TransferTelemetry
+{
+public:
+    enum Section {
+        Preamble,                   // v2 handshake and session header
+        FileName,
+        FileSize,
+        Data,
+        Framing,                    // v2 frame headers and holes
+        SectionCount
+    };
+
+    TransferTelemetry();
+    void begin(bool sending, const QString &peer);
+    inline bool isActive() const { return mActive; }
+    inline qint64 clock() const { return mClock.nsecsElapsed(); }
+    void connected(bool v2);
+    inline void addBytes(Section s, qint64 bytes) { mBytes[s] += bytes; }
+    inline void addChunk() { mChunks++; }
+    inline void addElement() { mElements++; }
+    inline void addDiskTime(qint64 since) { mDiskNs += clock() - since; }
+    inline void addBusyTime(qint64 since) { mBusyNs += clock() - since; }
+    inline void wrote() { mWriteMark = clock(); }
+    void drained();
+    void throttled();
+    void resumed();
+    void finish(const QString &result);
+    QJsonObject toJson() const;
+    static void appendToLog(const QString &path, const QJsonObject &record);
+
+private:
+    bool mActive;
+    bool mSending;
+    bool mV2;
+    QString mPeer;
+    QString mResult;
+    QDateTime mStarted;
+    QElapsedTimer mClock;
+    qint64 mDurationNs;
+    qint64 mConnectNs;              // -1 while connecting
+    qint64 mSocketWaitNs;
+    qint64 mDiskNs;
+    qint64 mThrottleNs;
+    qint64 mBusyNs;                 // Receiver, time spent processing the received data
+    qint64 mWriteMark;              // Last write to the socket, -1 if drained
+    qint64 mThrottleMark;           // Start of the current throttling, -1 if not throttled
+    qint64 mBytes[SectionCount];
+    qint64 mChunks;
+    qint64 mElements;
+};
+
+#endif // TRANSFERTELEMETRY_H
@@ -0,0 +1,174 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2011 Emanuele Colombo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "webserverbenchmark.h"
+
+#include <QTextStream>
+#include <QTimer>
+#include <QImage>
+
+#include <algorithm>
+
+#include "miniwebserver.h"
+
+#define DEFAULT_CLIENTS 64
+#define DEFAULT_DURATION 10
+#define DEFAULT_PORT 14645
+
+WebServerBenchmark::WebServerBenchmark(QObject *parent) :
+    QObject(parent), mServer(nullptr), mRunning(false),
+    mClientCount(DEFAULT_CLIENTS), mDuration(DEFAULT_DURATION), mPort(DEFAULT_PORT), mKeepAlive(true),
+    mRequests(0), mBytes(0), mConnections(0)
+{
+}
+
+WebServerBenchmark::~WebServerBenchmark()
+{
+    foreach (QTcpSocket *s, mSockets)
+        delete s;
+    if (mServer) delete mServer;
+}
+
+// Options: --clients=N --duration=SEC --port=P --no-keepalive
+bool WebServerBenchmark::configure(const QStringList &args)
+{
+    foreach (const QString &arg, args.mid(1))
+    {
+        if (arg == "--benchmark-avatar") continue;
+        if (arg == "--no-keepalive") {
+            mKeepAlive = false;
+            continue;
+        }
+        QString name = arg.section('=', 0, 0);
+        bool ok = false;
+        int value = arg.section('=', 1).toInt(&ok);
+        if (!ok || (value <= 0)) name.clear();
+
+        if (name == "--clients") mClientCount = value;
+        else if (name == "--duration") mDuration = value;
+        else if (name == "--port") mPort = value;
+        else
+        {
+            QTextStream(stderr) << "Unknown or malformed option: " << arg << Qt::endl
+                                << "Usage: dukto --benchmark-avatar [--clients=N] [--duration=SEC] [--port=P] [--no-keepalive]" << Qt::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+void WebServerBenchmark::start()
+{
+    // Any avatar will do, it's always 64x64 once scaled
+    QImage avatar(64, 64, QImage::Format_RGB32);
+    avatar.fill(Qt::darkGreen);
+    mServer = new MiniWebServer(mPort, avatar);
+    if (!mServer->isListening()) {
+        QTextStream(stderr) << "Cannot listen on port " << mPort << Qt::endl;
+        emit finished();
+        return;
+    }
+
+    mRunning = true;
+    mClock.start();
+    for (int i = 0; i < mClientCount; i++)
+    {
+        QTcpSocket *s = new QTcpSocket();
+        connect(s, SIGNAL(connected()), this, SLOT(clientConnected()));
+        connect(s, SIGNAL(readyRead()), this, SLOT(clientReadyRead()));
+        connect(s, SIGNAL(disconnected()), this, SLOT(clientDisconnected()));
+        mSockets.append(s);
+        s->connectToHost(QHostAddress::LocalHost, mPort);
+    }
+    QTimer::singleShot(mDuration * 1000, this, SLOT(stop()));
+}
+
+void WebServerBenchmark::sendRequest(QTcpSocket *socket)
+{
+    static const QByteArray keepAliveRequest = "GET /dukto/avatar HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    static const QByteArray closeRequest = "GET /dukto/avatar HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+    mClients[socket].sentAt = mClock.nsecsElapsed();
+    socket->write(mKeepAlive ? keepAliveRequest : closeRequest);
+}
+
+void WebServerBenchmark::clientConnected()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+    if (!socket || !mRunning) return;
+    mConnections++;
+    mClients[socket].buffer.clear();
+    sendRequest(socket);
+}
+
+void WebServerBenchmark::clientReadyRead()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+    if (!socket) return;
+    Client &c = mClients[socket];
+    c.buffer.append(socket->readAll());
+
+    // Complete responses: headers, then Content-Length bytes
+    while (true)
+    {
+        int end = c.buffer.indexOf("\r\n\r\n");
+        if (end < 0) return;
+        int cl = c.buffer.indexOf("Content-Length: ");
+        if ((cl < 0) || (cl > end)) return;
+        int length = c.buffer.mid(cl + 16, c.buffer.indexOf("\r\n", cl) - cl - 16).toInt();
+        if (c.buffer.size() < end + 4 + length) return;
+
+        c.buffer.remove(0, end + 4 + length);
+        mLatencies.append(mClock.nsecsElapsed() - c.sentAt);
+        mRequests++;
+        mBytes += end + 4 + length;
+
+        if (mRunning && mKeepAlive) sendRequest(socket);
+    }
+}
+
+// Without keep-alive, every request needs a new connection
+void WebServerBenchmark::clientDisconnected()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+    if (!socket || !mRunning) return;
+    socket->connectToHost(QHostAddress::LocalHost, mPort);
+}
+
+void WebServerBenchmark::stop()
+{
+    mRunning = false;
+    report();
+    emit finished();
+}
+
+void WebServerBenchmark::report()
+{
+    double seconds = mClock.elapsed() / 1000.0;
+    std::sort(mLatencies.begin(), mLatencies.end());
+    qint64 p50 = mLatencies.isEmpty() ? 0 : mLatencies.at(mLatencies.size() / 2);
+    qint64 p99 = mLatencies.isEmpty() ? 0 : mLatencies.at(qMin(mLatencies.size() - 1, mLatencies.size() * 99 / 100));
+
+    QTextStream out(stdout);
+    out << "Clients:            " << mClientCount << (mKeepAlive ? " (keep-alive)" : " (connection per request)") << Qt::endl
+        << "Duration:           " << seconds << " s" << Qt::endl
+        << "Requests:           " << mRequests << Qt::endl
+        << "Requests/s:         " << (mRequests / seconds) << Qt::endl
+        << "Throughput:         " << (mBytes / seconds / 1048576.0) << " MB/s" << Qt::endl
+        << "Connections:        " << mConnections << Qt::endl
+        << "Latency:            p50 " << (p50 / 1000) << " us, p99 " << (p99 / 1000) << " us" << Qt::endl;
+}
@@ -0,0 +1,83 @@
+/* DUKTO - A simple, fast and multi-platform file transfer tool for LAN users
+ * Copyright (C) 2011 Emanuele Colombo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef WEBSERVERBENCHMARK_H
+#define WEBSERVERBENCHMARK_H
+
+#include <QObject>
+#include <QList>
+#include <QHash>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QtNetwork/QTcpSocket>
+
+class MiniWebServer;
+
+// Load benchmark of the avatar server (dukto --benchmark-avatar).
+// A MiniWebServer and many HTTP clients run in the same process on
+// loopback; each client keeps one request in flight and issues the
+// next one as soon as the response is complete. Prints requests per
+// second and the response latency.
+class WebServerBenchmark : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit WebServerBenchmark(QObject *parent = nullptr);
+    virtual ~WebServerBenchmark();
+    bool configure(const QStringList &args);
+    void start();
+
+signals:
+    void finished();
+
+private slots:
+    void clientConnected();
+    void clientReadyRead();
+    void clientDisconnected();
+    void stop();
+
+private:
+    struct Client {
+        QByteArray buffer;
+        qint64 sentAt;              // ns, mClock time of the request in flight
+    };
+
+    void sendRequest(QTcpSocket *socket);
+    void report();
+
+    MiniWebServer *mServer;
+    QList<QTcpSocket*> mSockets;
+    QHash<QTcpSocket*, Client> mClients;
+    QElapsedTimer mClock;
+    bool mRunning;
+
+    // Configuration
+    int mClientCount;
+    int mDuration;                  // Seconds
+    qint16 mPort;
+    bool mKeepAlive;
+
+    // Statistics
+    qint64 mRequests;
+    qint64 mBytes;
+    qint64 mConnections;
+    QList<qint64> mLatencies;       // ns
+};
+
+#endif // WEBSERVERBENCHMARK_H